@@ -17,6 +17,8 @@ BuildRequires:	dmlite-devel >= 0.7.2
 BuildRequires:  dmlite-private-devel >= 0.7.2
 BuildRequires:	hadoop-libhdfs
 BuildRequires:	java-devel
+BuildRequires:	openssl-devel
+BuildRequires:	zlib-devel
 
 Requires:	dmlite-libs >= 0.7.2
 Requires: 	java-devel
@@ -26,7 +26,9 @@ Logger::component dmlite::hdfslogname = "Hdfs";
 // HdfsFactory implementation
 HdfsFactory::HdfsFactory() throw (DmException):
       nameNode("localhost"), port(8020), uname("dpmmgr"), tmpFolder("/tmp"),
-      tokenPasswd("default"), tokenUseIp(true), tokenLife(600), replication(2)
+      tokenPasswd("default"), tokenUseIp(true), tokenLife(600), replication(2),
+      warmUpConnections(1), zeroCopy(false), zeroCopySkipChecksum(false),
+      readBufferMin(4096), readBufferMax(4 * 1024 * 1024), directWrite(false)
 {
   // Nothing
   hdfslogmask = Logger::get()->getMask(hdfslogname);
@@ -54,6 +56,111 @@ void HdfsFactory::configure(const std::string& key, const std::string& value) th
   else if (key == "HdfsUser") {
     this->uname = value;
   }
+  else if (key == "HdfsConnectionPoolSize") {
+    HdfsConnectionPool::instance()->setMaxIdle((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsConnectionIdleTimeout") {
+    HdfsConnectionPool::instance()->setIdleTimeout((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsConnectionValidateInterval") {
+    HdfsConnectionPool::instance()->setValidateInterval((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsMaxConcurrentOps") {
+    HdfsAdmission::setMaxConcurrent((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsAdmissionTimeout") {
+    HdfsAdmission::setTimeout((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsBlockLocationCacheTTL") {
+    HdfsLocality::setCacheTTL((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsChecksumTypes") {
+    HdfsChecksum::setTypes(value);
+  }
+  else if (key == "HdfsChecksumDir") {
+    HdfsChecksum::setDirectory(value);
+  }
+  else if (key == "HdfsConnectTimeout") {
+    HdfsConnectionPool::instance()->setConnectTimeout((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsConnectThreads") {
+    HdfsConnectionPool::instance()->setConnectThreads((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsNameNodeProbeInterval") {
+    HdfsNameNodes::setProbeInterval((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsWarmUpConnections") {
+    this->warmUpConnections = (unsigned)atoi(value.c_str());
+  }
+  else if (key == "HdfsReadAheadBlocks") {
+    HdfsReadAhead::setBlocks((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsReadAheadBlockSize") {
+    HdfsReadAhead::setBlockSize((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsReadAheadThreads") {
+    HdfsReadAhead::setThreads((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsReadvMaxGap") {
+    HdfsVectorRead::setMaxGap((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsReadvMaxSize") {
+    HdfsVectorRead::setMaxSize((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsReadvThreads") {
+    HdfsVectorRead::setThreads((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsShortCircuitSocket") {
+    HdfsConnectionPool::instance()->setShortCircuit(value);
+  }
+  else if (key == "HdfsZeroCopyRead") {
+    this->zeroCopy = (strcasecmp(value.c_str(), "yes") == 0);
+  }
+  else if (key == "HdfsZeroCopySkipChecksum") {
+    this->zeroCopySkipChecksum = (strcasecmp(value.c_str(), "yes") == 0);
+  }
+  else if (key == "HdfsBlockCacheSize") {
+    HdfsBlockCache::setCapacity(strtoull(value.c_str(), NULL, 10));
+  }
+  else if (key == "HdfsBlockCacheSegmentSize") {
+    HdfsBlockCache::setSegmentSize((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsDiskCacheDir") {
+    HdfsDiskCache::setDirectory(value);
+  }
+  else if (key == "HdfsDiskCacheSize") {
+    HdfsDiskCache::setCapacity(strtoull(value.c_str(), NULL, 10));
+  }
+  else if (key == "HdfsReadBufferMin") {
+    this->readBufferMin = (unsigned)atoi(value.c_str());
+  }
+  else if (key == "HdfsReadBufferMax") {
+    this->readBufferMax = (unsigned)atoi(value.c_str());
+  }
+  else if (key == "HdfsCopyBufferSize") {
+    HdfsCopy::setBufferSize((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsCopyBuffers") {
+    HdfsCopy::setBuffers((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsCopyThreads") {
+    HdfsCopy::setThreads((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsMemorySpoolSize") {
+    HdfsMemorySpool::setMaxSize(strtoull(value.c_str(), NULL, 10));
+  }
+  else if (key == "HdfsMemorySpoolBudget") {
+    HdfsMemorySpool::setBudget(strtoull(value.c_str(), NULL, 10));
+  }
+  else if (key == "HdfsReassemblyMemory") {
+    HdfsReassembly::setMaxMemory(strtoull(value.c_str(), NULL, 10));
+  }
+  else if (key == "HdfsReassemblyBudget") {
+    HdfsReassembly::setBudget(strtoull(value.c_str(), NULL, 10));
+  }
+  else if (key == "HdfsDirectWrite") {
+    this->directWrite = (strcasecmp(value.c_str(), "yes") == 0);
+  }
   else if (key == "HdfsReplication") {
     this->replication = (unsigned)atoi(value.c_str());
   }
@@ -110,8 +217,13 @@ void HdfsFactory::configure(const std::string& key, const std::string& value) th
 
 IODriver* HdfsFactory::createIODriver(PluginManager* pm) throw (DmException)
 {
+  // The configuration is complete by now, warm up in the background
+  HdfsConnectionPool::instance()->warmUp(this->nameNode, this->port, this->uname,
+                                         this->warmUpConnections);
   return new HdfsIODriver(this->nameNode, this->port, this->uname,
-                            this->tokenPasswd, this->tokenUseIp, this->tmpFolder, this->replication);
+                            this->tokenPasswd, this->tokenUseIp, this->tmpFolder, this->replication,
+                            this->zeroCopy, this->zeroCopySkipChecksum,
+                            this->readBufferMin, this->readBufferMax, this->directWrite);
 }
 
 
@@ -125,6 +237,8 @@ std::string HdfsFactory::implementedPool() throw ()
 
 PoolDriver* HdfsFactory::createPoolDriver() throw (DmException)
 {
+  HdfsConnectionPool::instance()->warmUp(this->nameNode, this->port, this->uname,
+                                         this->warmUpConnections);
   return new HdfsPoolDriver(this->tokenPasswd,
                               this->tokenUseIp,
                               this->tokenLife,
@@ -27,10 +27,24 @@
 #include <dmlite/cpp/catalog.h>
 #include <dmlite/cpp/utils/logger.h>
 #include <vector>
+#include <map>
 #include <stdio.h>
 #include <fstream>
 #include <hdfs.h>
 #include <pthread.h>
+#include "HdfsWorkerPool.h"
+#include "HdfsConnectionPool.h"
+#include "HdfsNameNodes.h"
+#include "HdfsAdmission.h"
+#include "HdfsReadAhead.h"
+#include "HdfsVectorRead.h"
+#include "HdfsLocality.h"
+#include "HdfsBlockCache.h"
+#include "HdfsDiskCache.h"
+#include "HdfsChecksum.h"
+#include "HdfsCopy.h"
+#include "HdfsMemorySpool.h"
+#include "HdfsReassembly.h"
 #define PATH_MAX 4096
 #define BUFF_SIZE 65536
 
@@ -42,11 +56,13 @@ class HdfsPoolDriver;
    extern Logger::bitmask hdfslogmask;
    extern Logger::component hdfslogname;
 
-/// PoolHandler
+/// PoolHandler. Each call leases a pooled connection and gives it back
+/// when done, so a cached handler does not hold one.
 class HdfsPoolHandler: public PoolHandler {
 public:
 	HdfsPoolHandler(HdfsPoolDriver*, const std::string& nameNode,
-			const std::string& poolName, hdfsFS fs,
+			unsigned port, const std::string& uname,
+			const std::string& poolName,
 			StackInstance* si, char mode,unsigned replication);
 	~HdfsPoolHandler();
 
@@ -68,7 +84,8 @@ private:
 	HdfsPoolDriver* driver;
 
 	std::string    nameNode;
-	hdfsFS         fs;
+	unsigned       port;
+	std::string    uname;
 	std::string    poolName;
 	StackInstance* stack;
 	char           mode;
@@ -90,6 +107,10 @@ public:
 
 	PoolHandler* createPoolHandler(const std::string& poolName) throw (DmException);
 
+	/// Same as createPoolHandler, but the handler is cached and owned by the driver.
+	/// It is dropped when the pool is updated or deleted.
+	PoolHandler* getPoolHandler(const std::string& poolName) throw (DmException);
+
 	void toBeCreated(const Pool& pool) throw (DmException);
 	void justCreated(const Pool& pool) throw (DmException);
 	void update(const Pool& pool) throw (DmException);
@@ -105,18 +126,59 @@ private:
 	std::string userId;
 	std::vector<std::string> gateways;
         unsigned replication;
+
+	std::map<std::string, PoolHandler*> handlers;
+	void dropPoolHandler(const std::string& poolName) throw ();
 };
 
 
 
+/// Counter which can be updated concurrently
+class HdfsCounter {
+public:
+	HdfsCounter(): value(0) {}
+	void     add(uint64_t n = 1) { __sync_fetch_and_add(&value, n); }
+	void     sub(uint64_t n = 1) { __sync_fetch_and_sub(&value, n); }
+	uint64_t get(void)           { return __sync_fetch_and_add(&value, 0); }
+private:
+	volatile uint64_t value;
+};
+
+/// Process-wide statistics of the IO handlers
+struct HdfsIOStats {
+	static HdfsCounter opens;      // hdfs files actually opened
+	static HdfsCounter opensSaved; // handlers closed without any I/O, so never opened
+	static HdfsCounter readAheadHits;    // bytes read from the prefetched blocks
+	static HdfsCounter readAheadMisses;  // bytes read directly by the read-ahead handlers
+	static HdfsCounter readAheadFetched; // bytes prefetched
+	static HdfsCounter readAheadWasted;  // bytes prefetched but never read
+	static HdfsCounter cacheHits;      // segments found in the block cache
+	static HdfsCounter cacheMisses;    // segments fetched into the block cache
+	static HdfsCounter cacheWaits;     // hits on a segment being fetched by another reader
+	static HdfsCounter cacheEvictions; // segments dropped from the block cache
+	static HdfsCounter diskHits;       // segments read from the disk cache
+	static HdfsCounter diskMisses;     // segments not in the disk cache
+	static HdfsCounter diskAdmissions; // segments stored in the disk cache
+	static HdfsCounter diskEvictions;  // segments removed from the disk cache
+	static HdfsCounter uploadsDirect;   // uploads streamed to hdfs as written
+	static HdfsCounter uploadsSpooled;  // uploads copied to hdfs from the temp file at close
+	static HdfsCounter uploadsFallback; // direct uploads moved to the temp file by a seek
+	static HdfsCounter uploadsSpilled;  // uploads moved from memory to the temp file
+	static HdfsCounter spoolMemory;     // bytes held by the memory spools
+	static HdfsCounter writesReordered;   // streamed writes which arrived before the data preceding them
+	static HdfsCounter reassemblySpilled; // bytes of them kept in the gap files
+	static HdfsCounter reassemblyMemory;  // bytes of them held in memory
+};
+
 // IO Handler
 class HdfsIODriver;
 
 class HdfsIOHandler: public IOHandler{
 public:
 
+	/// bufferSize is the hdfs buffer size, 0 to choose it at open
 	HdfsIOHandler(HdfsIODriver* driver, const std::string& pfn,
-			int flags) throw (DmException);
+			int flags, unsigned bufferSize = 0) throw (DmException);
 	~HdfsIOHandler();
 
 	void   close(void) throw (DmException);
@@ -127,6 +189,9 @@ public:
 	void   flush(void) throw (DmException);
 	bool   eof  (void) throw (DmException);
         size_t pread(void* buffer, size_t count, off_t offset) throw (DmException);
+        size_t pwrite(const void* buffer, size_t count, off_t offset) throw (DmException);
+        /// Vectored pread, returns the total number of bytes read
+        size_t preadv(std::vector<HdfsReadChunk>& chunks) throw (DmException);
         struct stat fstat(void) throw (DmException);
         size_t writeToHDFS(const char* buffer, size_t count) throw (DmException);
         int    copyToHDFS(void) throw (DmException);
@@ -145,13 +210,61 @@ protected:
             };
 
 private:
+	/// Kind of access which triggered the open, used to size the buffer
+	enum AccessHint { kAccessUnknown, kAccessSequential, kAccessRandom };
+
+	void openFile(AccessHint hint = kAccessUnknown) throw (DmException);
+	/// As HdfsConnection::check, for the namenode RPCs on fs
+	bool checkFs(bool ok) throw ();
+	/// Gives fs back to the pool, closed if an RPC found it broken
+	void releaseFs(void) throw ();
+	/// Called once the file info is known
+	unsigned chooseBufferSize(AccessHint hint) throw ();
+	/// Reads at the stream cursor, with zero copy if enabled
+	tSize readStream(char* buffer, size_t count) throw ();
+	/// Creates the buffer of the writes, in memory if enabled
+	void openSpool(void) throw (DmException);
+	void openTempFile(void) throw (DmException);
+	/// Moves the memory spool to the temp file
+	void spill(void) throw (DmException);
+	size_t spoolWrite(const char* buffer, size_t count, off_t offset) throw (DmException);
+	/// Streams or spools a write
+	size_t writeAt(const char* buffer, size_t count, off_t offset) throw (DmException);
+	/// Size of the upload so far
+	off_t  writtenSize(void) throw (DmException);
+	/// Once the upload is in hdfs
+	void   storeChecksum(void) throw ();
+	/// Moves a direct upload to the temp file, for a non sequential write
+	void fallBackToSpool(void) throw (DmException);
+
 	HdfsIODriver* driver;
-        hdfsFS fs;
-	hdfsFile file;  // Hdfs file descriptor
+        hdfsFS fs;      // leased on the first I/O
+	bool     fsBroken;    // a namenode RPC on fs failed with a connection error
+	bool     fsSucceeded; // a namenode RPC on fs succeeded
+	hdfsFile file;  // Hdfs file descriptor, opened on the first I/O
+	bool     opened;// Set to true once the hdfs file has been opened
+	volatile bool ready; // fs and file can be used without mtx_ (see pread)
 	bool     isEof; // Set to true if end of the file is reached
+	off_t    pos;   // read cursor
+	struct stat fileStat; // of the file being read, taken at open
+	HdfsReadAhead* readAhead; // 0 unless the read-ahead is enabled
+#ifdef HAVE_HADOOP_READ_ZERO
+	struct hadoopRzOptions* rzOptions; // 0 unless the zero copy reads are enabled
+#endif
+	uint64_t zeroCopyBytes; // bytes read with zero copy
+	uint64_t copiedBytes;   // bytes copied by libhdfs
 	std::string path;
+	std::string hdfsPath; // path without the host info
+	int         openFlags;
+	unsigned    bufferSize; // 0 means chosen at open
 	std::string tmpFolder;// temporary folder
 	bool isWriting; //set for writing operations;
+	bool streaming; // writes go straight to hdfs, without the temp file
+	bool failed;    // the data could not be moved to the spool, the upload is lost
+	off_t writePos; // write cursor
+	HdfsReassembly*  reassembly; // orders the streamed writes, 0 until the first one
+	HdfsMemorySpool* memSpool; // the writes are buffered in memory while not 0
+	HdfsChecksum*    checksum; // of the data written to hdfs, 0 unless enabled
         int  temp_fd; //file descriptor of the tmp file used to buffer write requests
         char temp_path[PATH_MAX];
 	
@@ -164,7 +277,9 @@ private:
 class HdfsIODriver: public IODriver {
 public:
 	HdfsIODriver(const std::string&, unsigned, const std::string&,
-			const std::string&, bool, const std::string&,  unsigned replication);
+			const std::string&, bool, const std::string&,  unsigned replication,
+			bool zeroCopy, bool zeroCopySkipChecksum,
+			unsigned readBufferMin, unsigned readBufferMax, bool directWrite);
 	~HdfsIODriver();
 
 	std::string getImplId() const throw();
@@ -191,7 +306,13 @@ private:
 	std::string userId;
 	std::string tmpFolder;
         unsigned replication;
-	void updateReplica(hdfsFS fs, std::string& final) throw (DmException);
+	bool        zeroCopy;             // read through hadoopReadZero when possible
+	bool        zeroCopySkipChecksum; // lets the blocks not cached by the datanode be mmapped
+	unsigned    readBufferMin; // bounds of the read buffer sizes chosen at open
+	unsigned    readBufferMax;
+	bool        directWrite;   // stream the sequential uploads without the temp file
+	void updateReplica(hdfsFS fs, std::string& final,
+			const std::map<std::string, std::string>& checksums) throw (DmException);
 
 };
 
@@ -220,6 +341,12 @@ private:
 	bool        tokenUseIp;
 	unsigned    tokenLife;
         unsigned    replication;
+	unsigned    warmUpConnections;
+	bool        zeroCopy;
+	bool        zeroCopySkipChecksum;
+	unsigned    readBufferMin;
+	unsigned    readBufferMax;
+	bool        directWrite;
 	
 };
 
@@ -237,6 +364,10 @@ public:
 	static std::string getRandomGateway(const std::vector<std::string>& gateways) throw();
 	static int mkdirs(const char *dir) throw ();
         static std::string trim(std::string& str) throw ();
+	/// Milliseconds elapsed since start
+	static double elapsed(const struct timeval& start) throw ();
+	/// The errno left by a failed hdfs call means the namenode was not reached
+	static bool isConnectionError(int err) throw ();
 
 };
 
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsAccessPattern.cpp
+/// @brief   classification of the reads of a file.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "HdfsAccessPattern.h"
+
+using namespace dmlite;
+
+// Reads in a row needed to switch to a pattern
+#define SEQUENTIAL_RUN 2
+#define STRIDED_RUN    2
+#define RANDOM_RUN     2
+
+
+
+HdfsAccessPattern::HdfsAccessPattern():
+  pattern(kUnknown), first(true), lastOffset(0), lastSize(0), stride(0),
+  sequentialRun(0), stridedRun(0), randomRun(0)
+{
+}
+
+
+
+HdfsAccessPattern::Pattern HdfsAccessPattern::record(off_t offset, size_t size) throw ()
+{
+  if (this->first) {
+    this->first      = false;
+    this->lastOffset = offset;
+    this->lastSize   = size;
+    return this->pattern;
+  }
+
+  off_t delta = offset - this->lastOffset;
+
+  if (offset == this->lastOffset + (off_t)this->lastSize) {
+    this->sequentialRun++;
+    this->stridedRun = this->randomRun = 0;
+  }
+  else if (delta > 0 && delta == this->stride) {
+    this->stridedRun++;
+    this->sequentialRun = this->randomRun = 0;
+  }
+  else {
+    this->randomRun++;
+    this->sequentialRun = this->stridedRun = 0;
+  }
+
+  // The stride is confirmed by the next read
+  if (this->stridedRun == 0)
+    this->stride = delta;
+  this->lastOffset = offset;
+  this->lastSize   = size;
+
+  if (this->sequentialRun >= SEQUENTIAL_RUN)
+    this->pattern = kSequential;
+  else if (this->stridedRun >= STRIDED_RUN)
+    this->pattern = kStrided;
+  else if (this->randomRun >= RANDOM_RUN)
+    this->pattern = kRandom;
+
+  return this->pattern;
+}
+
+
+
+const char* HdfsAccessPattern::name(Pattern pattern) throw ()
+{
+  switch (pattern) {
+    case kSequential:
+      return "sequential";
+    case kStrided:
+      return "strided";
+    case kRandom:
+      return "random";
+    default:
+      return "unknown";
+  }
+}
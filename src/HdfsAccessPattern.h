@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsAccessPattern.h
+/// @brief   classification of the reads of a file.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSACCESSPATTERN_H
+#define HDFSACCESSPATTERN_H
+
+#include <sys/types.h>
+
+namespace dmlite {
+
+/// Tells sequential, strided and random reads apart from their offsets.
+/// The pattern changes only after a few reads in a row agree, so that an
+/// odd seek does not throw the prefetch away.
+class HdfsAccessPattern {
+public:
+	enum Pattern { kUnknown, kSequential, kStrided, kRandom };
+
+	HdfsAccessPattern();
+
+	/// Returns the pattern including this read
+	Pattern record(off_t offset, size_t size) throw ();
+
+	Pattern get(void) const { return pattern; }
+	/// Distance between the starts of the strided reads
+	off_t   getStride(void) const { return stride; }
+
+	static const char* name(Pattern pattern) throw ();
+
+private:
+	Pattern  pattern;
+	bool     first;
+	off_t    lastOffset;
+	size_t   lastSize;
+	off_t    stride;
+	unsigned sequentialRun;
+	unsigned stridedRun;
+	unsigned randomRun;
+};
+
+};
+
+#endif // HDFSACCESSPATTERN_H
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsAdmission.cpp
+/// @brief   admission control of the namenode operations.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+using namespace dmlite;
+
+unsigned HdfsAdmission::maxConcurrent = 0;
+unsigned HdfsAdmission::timeout       = 0;
+
+static pthread_mutex_t registryMtx = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, HdfsAdmission*> registry;
+
+// Tickets held by the current thread
+static __thread unsigned ticketDepth = 0;
+
+
+
+HdfsAdmission* HdfsAdmission::get(const std::string& nameNode) throw ()
+{
+  HdfsLock l(&registryMtx);
+
+  std::map<std::string, HdfsAdmission*>::iterator i = registry.find(nameNode);
+  if (i != registry.end())
+    return i->second;
+
+  HdfsAdmission* admission = new HdfsAdmission(nameNode);
+  registry[nameNode] = admission;
+  return admission;
+}
+
+
+
+void HdfsAdmission::setMaxConcurrent(unsigned maxConcurrent) throw ()
+{
+  HdfsAdmission::maxConcurrent = maxConcurrent;
+}
+
+
+
+void HdfsAdmission::setTimeout(unsigned seconds) throw ()
+{
+  HdfsAdmission::timeout = seconds;
+}
+
+
+
+HdfsAdmission::HdfsAdmission(const std::string& nameNode):
+  nameNode(nameNode), active(0)
+{
+  pthread_mutex_init(&this->mtx_, 0);
+  memset(&this->stats, 0, sizeof(this->stats));
+}
+
+
+
+HdfsAdmissionStats HdfsAdmission::getStats(void) throw ()
+{
+  HdfsLock l(&this->mtx_);
+  return this->stats;
+}
+
+
+
+void HdfsAdmission::enter(void) throw (DmException)
+{
+  HdfsLock l(&this->mtx_);
+
+  if (maxConcurrent == 0 || (this->active < maxConcurrent && this->queue.empty())) {
+    this->active++;
+    this->stats.admitted++;
+    return;
+  }
+
+  Waiter waiter;
+  pthread_cond_init(&waiter.cond, 0);
+  waiter.granted = false;
+
+  this->queue.push_back(&waiter);
+  this->stats.waited++;
+  this->stats.queued++;
+  if (this->stats.queued > this->stats.maxQueued)
+    this->stats.maxQueued = this->stats.queued;
+
+  struct timeval start;
+  gettimeofday(&start, NULL);
+
+  struct timespec deadline;
+  deadline.tv_sec  = start.tv_sec + timeout;
+  deadline.tv_nsec = start.tv_usec * 1000;
+
+  while (!waiter.granted) {
+    int err = timeout ? pthread_cond_timedwait(&waiter.cond, &this->mtx_, &deadline)
+                      : pthread_cond_wait(&waiter.cond, &this->mtx_);
+    if (err == ETIMEDOUT && !waiter.granted)
+      break;
+  }
+
+  uint64_t waitTime = (uint64_t)(HDFSUtil::elapsed(start) * 1000);
+  this->stats.queued--;
+  this->stats.waitTime += waitTime;
+  if (waitTime > this->stats.maxWaitTime)
+    this->stats.maxWaitTime = waitTime;
+
+  pthread_cond_destroy(&waiter.cond);
+
+  if (!waiter.granted) {
+    this->queue.erase(std::find(this->queue.begin(), this->queue.end(), &waiter));
+    this->stats.timeouts++;
+    throw DmException(EBUSY, "Too many concurrent operations on %s, gave up after %u s in queue",
+                      this->nameNode.c_str(), timeout);
+  }
+
+  // The slot has been handed over by leave(), active already counts it
+  this->stats.admitted++;
+  Log(Logger::Lvl4, hdfslogmask, hdfslogname, "admitted after " << waitTime << " us in queue, queued: " << this->stats.queued);
+}
+
+
+
+void HdfsAdmission::leave(void) throw ()
+{
+  HdfsLock l(&this->mtx_);
+
+  // Hand the slot over to the oldest waiter
+  if (!this->queue.empty()) {
+    Waiter* waiter = this->queue.front();
+    this->queue.pop_front();
+    waiter->granted = true;
+    pthread_cond_signal(&waiter->cond);
+  }
+  else {
+    this->active--;
+  }
+}
+
+
+
+HdfsAdmissionTicket::HdfsAdmissionTicket(const std::string& nameNode) throw (DmException):
+  admission(0)
+{
+  if (ticketDepth == 0) {
+    HdfsAdmission* admission = HdfsAdmission::get(nameNode);
+    admission->enter();
+    this->admission = admission;
+  }
+  ticketDepth++;
+}
+
+
+
+HdfsAdmissionTicket::~HdfsAdmissionTicket()
+{
+  ticketDepth--;
+  if (this->admission)
+    this->admission->leave();
+}
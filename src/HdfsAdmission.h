@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsAdmission.h
+/// @brief   admission control of the namenode operations.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSADMISSION_H
+#define HDFSADMISSION_H
+
+#include <dmlite/cpp/exceptions.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+namespace dmlite {
+
+/// Counters kept by the admission control of a namenode
+struct HdfsAdmissionStats {
+	uint64_t admitted;    // operations let through
+	uint64_t waited;      // operations which had to queue
+	uint64_t timeouts;    // operations which gave up queuing
+	uint64_t queued;      // operations currently queued
+	uint64_t maxQueued;   // deepest queue seen
+	uint64_t waitTime;    // total time spent queuing (us)
+	uint64_t maxWaitTime; // longest time spent queuing (us)
+};
+
+/// Limits the number of concurrent operations (file opens, metadata RPCs)
+/// sent to a namenode. The operations above the limit wait in a FIFO queue.
+class HdfsAdmission {
+public:
+	/// Returns the admission control of the given namenode(s)
+	static HdfsAdmission* get(const std::string& nameNode) throw ();
+
+	/// 0 means no limit
+	static void setMaxConcurrent(unsigned maxConcurrent) throw ();
+	/// Max seconds to queue, 0 means no limit
+	static void setTimeout(unsigned seconds) throw ();
+	static bool enabled(void) throw () { return maxConcurrent != 0; }
+
+	void enter(void) throw (DmException);
+	void leave(void) throw ();
+
+	HdfsAdmissionStats getStats(void) throw ();
+
+private:
+	HdfsAdmission(const std::string& nameNode);
+
+	struct Waiter {
+		pthread_cond_t cond;
+		bool           granted;
+	};
+
+	std::string nameNode;
+
+	pthread_mutex_t mtx_;
+	unsigned active;
+	std::deque<Waiter*> queue;
+
+	HdfsAdmissionStats stats;
+
+	static unsigned maxConcurrent;
+	static unsigned timeout;
+};
+
+/// Admission of an operation for the scope of the ticket.
+/// Nested tickets in the same thread go straight through, so that an
+/// operation calling another one can not deadlock on the limit.
+class HdfsAdmissionTicket {
+public:
+	HdfsAdmissionTicket(const std::string& nameNode) throw (DmException);
+	~HdfsAdmissionTicket();
+
+private:
+	HdfsAdmissionTicket(const HdfsAdmissionTicket&);
+	HdfsAdmissionTicket& operator = (const HdfsAdmissionTicket&);
+
+	HdfsAdmission* admission; // 0 if nested
+};
+
+};
+
+#endif // HDFSADMISSION_H
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsBlockCache.cpp
+/// @brief   process-wide cache of the hot file segments.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace dmlite;
+
+pthread_mutex_t HdfsBlockCache::mtx_    = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  HdfsBlockCache::loaded_ = PTHREAD_COND_INITIALIZER;
+
+std::map<HdfsBlockCache::Key, HdfsBlockCache::Segment*> HdfsBlockCache::segments;
+std::list<HdfsBlockCache::Segment*> HdfsBlockCache::lru;
+
+uint64_t HdfsBlockCache::capacity    = 0;
+uint64_t HdfsBlockCache::used        = 0;
+unsigned HdfsBlockCache::segmentSize = 1024 * 1024;
+
+
+
+bool HdfsBlockCache::Key::operator < (const Key& b) const
+{
+  if (this->index != b.index)
+    return this->index < b.index;
+  if (this->mtime != b.mtime)
+    return this->mtime < b.mtime;
+  if (this->size != b.size)
+    return this->size < b.size;
+  return this->path < b.path;
+}
+
+
+
+void HdfsBlockCache::setCapacity(uint64_t bytes) throw ()
+{
+  HdfsLock l(&mtx_);
+  capacity = bytes;
+  evict();
+}
+
+
+
+void HdfsBlockCache::setSegmentSize(unsigned size) throw ()
+{
+  HdfsLock l(&mtx_);
+  // Only before the first read, the segments are indexed by it
+  if (segments.empty())
+    segmentSize = size > 0 ? size : BUFF_SIZE;
+}
+
+
+
+bool HdfsBlockCache::enabled(void) throw ()
+{
+  return capacity > 0 || HdfsDiskCache::enabled();
+}
+
+
+
+void HdfsBlockCache::evict(void) throw ()
+{
+  while (used > capacity && !lru.empty()) {
+    Segment* segment = lru.back();
+    lru.pop_back();
+    segments.erase(segment->key);
+
+    used -= segment->data.size();
+    segment->cached = false;
+    HdfsIOStats::cacheEvictions.add();
+
+    if (segment->refs == 0)
+      delete segment;
+  }
+}
+
+
+
+HdfsBlockCache::Segment* HdfsBlockCache::get(hdfsFS fs, hdfsFile file, const Key& key,
+                                             off_t fileSize, size_t size) throw ()
+{
+  Segment* segment;
+
+  {
+    HdfsLock l(&mtx_);
+
+    std::map<Key, Segment*>::iterator i = segments.find(key);
+    if (i != segments.end()) {
+      segment = i->second;
+      segment->refs++;
+
+      if (segment->loading) {
+        // Someone else is fetching it
+        HdfsIOStats::cacheWaits.add();
+        while (segment->loading)
+          pthread_cond_wait(&loaded_, &mtx_);
+        if (segment->failed) {
+          segment->refs--;
+          if (segment->refs == 0)
+            delete segment;
+          return 0;
+        }
+      }
+      else {
+        lru.splice(lru.begin(), lru, segment->lru);
+      }
+
+      HdfsIOStats::cacheHits.add();
+      return segment;
+    }
+
+    HdfsIOStats::cacheMisses.add();
+
+    segment = new Segment();
+    segment->key     = key;
+    segment->loading = true;
+    segment->failed  = false;
+    segment->cached  = true;
+    segment->refs    = 1;
+    segments[key] = segment;
+  }
+
+  // Fetched without the lock, the other readers of this segment wait for it
+  off_t offset = key.index * (off_t)segmentSize;
+  segment->data.resize(size);
+
+  tSize n;
+  if (HdfsDiskCache::enabled())
+    n = HdfsDiskCache::fetch(fs, file, key.path, key.mtime, fileSize, offset, &segment->data[0], size);
+  else
+    n = HdfsReadAhead::preadFully(fs, file, offset, &segment->data[0], size);
+
+  HdfsLock l(&mtx_);
+
+  segment->loading = false;
+  if (n < 0) {
+    segment->failed = true;
+    segment->cached = false;
+    segments.erase(key);
+  }
+  else {
+    segment->data.resize(n);
+    lru.push_front(segment);
+    segment->lru = lru.begin();
+    used += n;
+    evict();
+  }
+  pthread_cond_broadcast(&loaded_);
+
+  if (segment->failed) {
+    if (--segment->refs == 0)
+      delete segment;
+    return 0;
+  }
+  return segment;
+}
+
+
+
+void HdfsBlockCache::put(Segment* segment) throw ()
+{
+  HdfsLock l(&mtx_);
+  if (--segment->refs == 0 && !segment->cached)
+    delete segment;
+}
+
+
+
+tSize HdfsBlockCache::read(hdfsFS fs, hdfsFile file, const std::string& path,
+                           const struct stat& st, char* buffer, size_t count, off_t offset) throw ()
+{
+  size_t done = 0;
+
+  Key key;
+  key.path  = path;
+  key.mtime = st.st_mtime;
+  key.size  = st.st_size;
+
+  while (done < count && offset + (off_t)done < st.st_size) {
+    off_t cursor = offset + done;
+    key.index    = cursor / segmentSize;
+
+    off_t  start   = key.index * (off_t)segmentSize;
+    size_t size    = std::min((off_t)segmentSize, st.st_size - start);
+    Segment* segment = get(fs, file, key, st.st_size, size);
+
+    if (!segment) {
+      // Let the direct read report the error
+      tSize n = HdfsReadAhead::preadFully(fs, file, cursor, buffer + done, count - done);
+      if (n < 0)
+        return done ? (tSize)done : -1;
+      done += n;
+      break;
+    }
+
+    size_t within = cursor - start;
+    if (within >= segment->data.size()) {
+      // The file is shorter than when it was opened
+      put(segment);
+      break;
+    }
+
+    size_t n = std::min(segment->data.size() - within, count - done);
+    memcpy(buffer + done, &segment->data[within], n);
+    put(segment);
+    done += n;
+  }
+
+  return (tSize)done;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsBlockCache.h
+/// @brief   process-wide cache of the hot file segments.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSBLOCKCACHE_H
+#define HDFSBLOCKCACHE_H
+
+#include <hdfs.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dmlite {
+
+/// LRU cache of fixed size file segments shared by all the IO handlers.
+/// The segments are keyed by path, modification time, size and offset, so a
+/// rewritten file is never served from the old segments: libhdfs gives the
+/// modification time in seconds only, the size tells apart most rewrites
+/// within the same second. Concurrent misses
+/// of the same segment wait for a single fetch.
+class HdfsBlockCache {
+public:
+	/// Max bytes cached in memory. With 0, the segments are used only by the
+	/// reads in progress, and the cache is enabled only for the disk tier.
+	static void setCapacity(uint64_t bytes) throw ();
+	static void setSegmentSize(unsigned size) throw ();
+
+	static bool enabled(void) throw ();
+
+	/// Reads count bytes at offset of the file described by st.
+	/// Returns less than count only at the end of the file, -1 on error.
+	static tSize read(hdfsFS fs, hdfsFile file, const std::string& path,
+			const struct stat& st, char* buffer, size_t count, off_t offset) throw ();
+
+private:
+	struct Key {
+		std::string path;
+		time_t      mtime;
+		off_t       size;
+		off_t       index;
+		bool operator < (const Key&) const;
+	};
+
+	struct Segment {
+		Key  key;
+		std::vector<char> data;
+		bool loading; // being fetched, the other readers wait for it
+		bool failed;
+		bool cached;  // still in the cache, deleted by the last reader otherwise
+		int  refs;
+		std::list<Segment*>::iterator lru;
+	};
+
+	/// Returns the segment with a reference, 0 if it could not be fetched
+	static Segment* get(hdfsFS fs, hdfsFile file, const Key& key, off_t fileSize,
+			size_t size) throw ();
+	static void     put(Segment* segment) throw ();
+	/// Drops the least recently used segments above the capacity. Called with mtx_ held.
+	static void     evict(void) throw ();
+
+	static pthread_mutex_t mtx_;
+	static pthread_cond_t  loaded_;
+
+	static std::map<Key, Segment*> segments;
+	static std::list<Segment*>     lru; // most recently used first
+
+	static uint64_t capacity;
+	static uint64_t used;
+	static unsigned segmentSize;
+};
+
+};
+
+#endif // HDFSBLOCKCACHE_H
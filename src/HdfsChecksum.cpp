@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsChecksum.cpp
+/// @brief   checksums of the uploads, stored next to the files.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <algorithm>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/opensslv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sstream>
+#include <strings.h>
+#include <zlib.h>
+
+using namespace dmlite;
+
+// OpenSSL 1.0 (EL6, EL7) names the digest context functions differently
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new  EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+unsigned    HdfsChecksum::enabledTypes = 0;
+std::string HdfsChecksum::directory    = "/.dmlite/checksums";
+
+// Values of the uploads closed but not done yet, oldest first.
+// Bounded, an upload may never be done.
+#define MAX_REMEMBERED 1024
+static pthread_mutex_t rememberedMtx = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, std::map<std::string, std::string> > remembered;
+static std::deque<std::string> rememberedOrder;
+
+// crc32c (Castagnoli) lookup tables for slicing by 8, built on first use
+static uint32_t       crc32cTable[8][256];
+static pthread_once_t crc32cOnce = PTHREAD_ONCE_INIT;
+
+
+
+static void crc32cInit(void)
+{
+  for (uint32_t n = 0; n < 256; ++n) {
+    uint32_t crc = n;
+    for (int k = 0; k < 8; ++k)
+      crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+    crc32cTable[0][n] = crc;
+  }
+  for (uint32_t n = 0; n < 256; ++n) {
+    for (int t = 1; t < 8; ++t)
+      crc32cTable[t][n] = (crc32cTable[t - 1][n] >> 8) ^ crc32cTable[0][crc32cTable[t - 1][n] & 0xff];
+  }
+}
+
+
+
+static uint32_t crc32cUpdate(uint32_t crc, const unsigned char* p, size_t count)
+{
+  crc = ~crc;
+
+  while (count && ((uintptr_t)p & 7)) {
+    crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *p++) & 0xff];
+    count--;
+  }
+
+  // Eight bytes at a time, little endian
+  while (count >= 8) {
+    uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+    uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+    crc = crc32cTable[7][lo & 0xff] ^ crc32cTable[6][(lo >> 8) & 0xff] ^
+          crc32cTable[5][(lo >> 16) & 0xff] ^ crc32cTable[4][lo >> 24] ^
+          crc32cTable[3][hi & 0xff] ^ crc32cTable[2][(hi >> 8) & 0xff] ^
+          crc32cTable[1][(hi >> 16) & 0xff] ^ crc32cTable[0][hi >> 24];
+    p     += 8;
+    count -= 8;
+  }
+
+  while (count--)
+    crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *p++) & 0xff];
+
+  return ~crc;
+}
+
+
+
+void HdfsChecksum::setTypes(const std::string& types) throw (DmException)
+{
+  std::stringstream list(types);
+  std::string       type;
+  unsigned          mask = 0;
+
+  while (std::getline(list, type, ',')) {
+    type = fullName(HDFSUtil::trim(type));
+    if (type == "adler32")
+      mask |= kAdler32;
+    else if (type == "md5")
+      mask |= kMd5;
+    else if (type == "crc32c")
+      mask |= kCrc32c;
+    else if (!type.empty())
+      throw DmException(DMLITE_CFGERR(EINVAL), "Unknown checksum type %s", type.c_str());
+  }
+
+  enabledTypes = mask;
+}
+
+
+
+void HdfsChecksum::setDirectory(const std::string& dir) throw ()
+{
+  directory = dir;
+  // The file paths are absolute already
+  while (directory.size() > 1 && directory[directory.size() - 1] == '/')
+    directory.erase(directory.size() - 1);
+}
+
+
+
+bool HdfsChecksum::enabled(void) throw ()
+{
+  return enabledTypes != 0;
+}
+
+
+
+HdfsChecksum::HdfsChecksum():
+  types(enabledTypes), length(0), md5(0), crc(0)
+{
+  this->adler = adler32(0L, Z_NULL, 0);
+  if (this->types & kMd5) {
+    this->md5 = EVP_MD_CTX_new();
+    if (!this->md5 || EVP_DigestInit_ex(this->md5, EVP_md5(), NULL) != 1) {
+      Err(hdfslogname, "Could not initialise the md5 digest, not computing it");
+      this->types &= ~kMd5;
+    }
+  }
+  pthread_once(&crc32cOnce, crc32cInit);
+}
+
+
+
+HdfsChecksum::~HdfsChecksum()
+{
+  if (this->md5)
+    EVP_MD_CTX_free(this->md5);
+}
+
+
+
+void HdfsChecksum::update(const char* buffer, size_t count) throw ()
+{
+  this->length += count;
+
+  if (this->types & kAdler32) {
+    // uInt may be narrower than size_t
+    for (size_t done = 0; done < count; ) {
+      size_t n = std::min(count - done, (size_t)1 << 30);
+      this->adler = adler32(this->adler, (const Bytef*)buffer + done, (uInt)n);
+      done += n;
+    }
+  }
+  if (this->types & kMd5)
+    EVP_DigestUpdate(this->md5, buffer, count);
+  if (this->types & kCrc32c)
+    this->crc = crc32cUpdate(this->crc, (const unsigned char*)buffer, count);
+}
+
+
+
+void HdfsChecksum::final(std::map<std::string, std::string>& values) throw ()
+{
+  char hex[2 * EVP_MAX_MD_SIZE + 1];
+
+  if (this->types & kAdler32) {
+    snprintf(hex, sizeof(hex), "%08x", this->adler);
+    values["adler32"] = hex;
+  }
+  if (this->types & kMd5) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int  digestLength = 0;
+    EVP_DigestFinal_ex(this->md5, digest, &digestLength);
+    for (unsigned i = 0; i < digestLength; ++i)
+      snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    values["md5"] = hex;
+  }
+  if (this->types & kCrc32c) {
+    snprintf(hex, sizeof(hex), "%08x", this->crc);
+    values["crc32c"] = hex;
+  }
+}
+
+
+
+std::string HdfsChecksum::fullName(const std::string& name) throw ()
+{
+  if (name == "AD" || strcasecmp(name.c_str(), "adler32") == 0)
+    return "adler32";
+  if (name == "MD" || strcasecmp(name.c_str(), "md5") == 0)
+    return "md5";
+  if (strcasecmp(name.c_str(), "crc32c") == 0)
+    return "crc32c";
+  return name;
+}
+
+
+
+std::string HdfsChecksum::shortName(const std::string& name) throw ()
+{
+  if (name == "adler32")
+    return "AD";
+  if (name == "md5")
+    return "MD";
+  return std::string();
+}
+
+
+
+std::string HdfsChecksum::checksumPath(const std::string& path) throw ()
+{
+  return directory + path;
+}
+
+
+
+// One "name value" per line, after the size of the data
+void HdfsChecksum::store(hdfsFS fs, const std::string& path, uint64_t size,
+                         const std::map<std::string, std::string>& values) throw (DmException)
+{
+  std::stringstream content;
+  content << "size " << size << "\n";
+  std::map<std::string, std::string>::const_iterator i;
+  for (i = values.begin(); i != values.end(); ++i)
+    content << i->first << " " << i->second << "\n";
+  std::string data = content.str();
+
+  // The parent folders are created along
+  std::string csumPath = checksumPath(path);
+  hdfsFile file = hdfsOpenFile(fs, csumPath.c_str(), O_WRONLY, 0, 0, 0);
+  if (!file)
+    throw DmException(DMLITE_SYSERR(errno), "Could not create the checksum file %s", csumPath.c_str());
+
+  tSize n = hdfsWrite(fs, file, data.c_str(), data.size());
+  if (hdfsCloseFile(fs, file) != 0 || n != (tSize)data.size())
+    throw DmException(EIO, "Could not write the checksum file %s", csumPath.c_str());
+}
+
+
+
+bool HdfsChecksum::load(hdfsFS fs, const std::string& path, uint64_t size,
+                        std::map<std::string, std::string>& values) throw ()
+{
+  // No checksum file if it cannot be opened, no need for an hdfsExists first
+  std::string csumPath = checksumPath(path);
+  hdfsFile file = hdfsOpenFile(fs, csumPath.c_str(), O_RDONLY, 0, 0, 0);
+  if (!file)
+    return false;
+
+  char  buffer[1024];
+  tSize n = HdfsReadAhead::preadFully(fs, file, 0, buffer, sizeof(buffer) - 1);
+  hdfsCloseFile(fs, file);
+  if (n <= 0)
+    return false;
+  buffer[n] = '\0';
+
+  std::stringstream content(buffer);
+  std::string       name, value;
+  if (!(content >> name >> value) || name != "size" ||
+      strtoull(value.c_str(), NULL, 10) != size)
+    return false;
+
+  while (content >> name >> value)
+    values[name] = value;
+  return !values.empty();
+}
+
+
+
+void HdfsChecksum::remember(const std::string& path,
+                            const std::map<std::string, std::string>& values) throw ()
+{
+  HdfsLock l(&rememberedMtx);
+
+  if (remembered.find(path) == remembered.end())
+    rememberedOrder.push_back(path);
+  remembered[path] = values;
+
+  while (rememberedOrder.size() > MAX_REMEMBERED) {
+    remembered.erase(rememberedOrder.front());
+    rememberedOrder.pop_front();
+  }
+}
+
+
+
+bool HdfsChecksum::recall(const std::string& path,
+                          std::map<std::string, std::string>& values) throw ()
+{
+  HdfsLock l(&rememberedMtx);
+
+  std::map<std::string, std::map<std::string, std::string> >::iterator i = remembered.find(path);
+  if (i == remembered.end())
+    return false;
+
+  values = i->second;
+  remembered.erase(i);
+  rememberedOrder.erase(std::find(rememberedOrder.begin(), rememberedOrder.end(), path));
+  return true;
+}
+
+
+
+void HdfsChecksum::rename(hdfsFS fs, const std::string& oldPath, const std::string& newPath) throw ()
+{
+  std::string from = checksumPath(oldPath);
+  if (hdfsExists(fs, from.c_str()) != 0)
+    return;
+
+  std::string to = checksumPath(newPath);
+  hdfsCreateDirectory(fs, to.substr(0, to.find_last_of('/')).c_str());
+  hdfsDelete(fs, to.c_str(), 0);
+  if (hdfsRename(fs, from.c_str(), to.c_str()) != 0)
+    Err(hdfslogname, "Could not move the checksums of " << oldPath << " to " << to);
+}
+
+
+
+void HdfsChecksum::remove(hdfsFS fs, const std::string& path) throw ()
+{
+  std::string csumPath = checksumPath(path);
+  if (hdfsExists(fs, csumPath.c_str()) == 0)
+    hdfsDelete(fs, csumPath.c_str(), 1);
+}
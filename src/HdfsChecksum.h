@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsChecksum.h
+/// @brief   checksums of the uploads, stored next to the files.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSCHECKSUM_H
+#define HDFSCHECKSUM_H
+
+#include <dmlite/cpp/exceptions.h>
+#include <hdfs.h>
+#include <openssl/evp.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <map>
+#include <string>
+
+namespace dmlite {
+
+/// Computes the checksums of an upload while it is written to hdfs.
+/// libhdfs has no extended attributes, so the values are stored in a small
+/// file at the same path under the checksum directory, with the size of
+/// the data: a file rewritten by other means is not served a stale value.
+class HdfsChecksum {
+public:
+	enum Type { kAdler32 = 1, kMd5 = 2, kCrc32c = 4 };
+
+	/// Comma separated list of adler32, md5 and crc32c, empty to disable
+	static void setTypes(const std::string& types) throw (DmException);
+	static void setDirectory(const std::string& dir) throw ();
+
+	static bool enabled(void) throw ();
+
+	HdfsChecksum();
+	~HdfsChecksum();
+
+	/// Called with the data in order
+	void update(const char* buffer, size_t count) throw ();
+	/// Values by checksum name, the computation is over
+	void final(std::map<std::string, std::string>& values) throw ();
+	uint64_t size(void) const { return length; }
+
+	/// Name of the checksum given by the legacy dmlite name (AD, MD) too
+	static std::string fullName(const std::string& name) throw ();
+	/// Legacy dmlite name, empty if there is none
+	static std::string shortName(const std::string& name) throw ();
+
+	static void store(hdfsFS fs, const std::string& path, uint64_t size,
+			const std::map<std::string, std::string>& values) throw (DmException);
+	/// Returns false if there are none, or they are not of a file of this size
+	static bool load(hdfsFS fs, const std::string& path, uint64_t size,
+			std::map<std::string, std::string>& values) throw ();
+	/// Keeps the values of a closed upload in memory until its doneWriting,
+	/// so they are not read back from hdfs. Returns false if they are not known.
+	static void remember(const std::string& path,
+			const std::map<std::string, std::string>& values) throw ();
+	static bool recall(const std::string& path,
+			std::map<std::string, std::string>& values) throw ();
+	/// Follow the file, errors are ignored
+	static void rename(hdfsFS fs, const std::string& oldPath, const std::string& newPath) throw ();
+	static void remove(hdfsFS fs, const std::string& path) throw ();
+
+private:
+	HdfsChecksum(const HdfsChecksum&);
+	HdfsChecksum& operator = (const HdfsChecksum&);
+
+	static std::string checksumPath(const std::string& path) throw ();
+
+	unsigned types;
+	uint64_t length;
+	uint32_t adler;
+	EVP_MD_CTX* md5;
+	uint32_t crc;
+
+	static unsigned    enabledTypes;
+	static std::string directory;
+};
+
+};
+
+#endif // HDFSCHECKSUM_H
@@ -0,0 +1,734 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsConnectionPool.cpp
+/// @brief   process-wide pool of hdfsFS connections.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace dmlite;
+
+
+
+bool HdfsConnectionPool::Key::operator < (const Key& other) const
+{
+  if (this->nameNode != other.nameNode)
+    return this->nameNode < other.nameNode;
+  if (this->port != other.port)
+    return this->port < other.port;
+  return this->user < other.user;
+}
+
+
+
+bool HdfsConnectionPool::Endpoint::operator != (const Endpoint& other) const
+{
+  return this->host != other.host || this->port != other.port;
+}
+
+
+
+pthread_key_t  HdfsConnectionPool::threadKey_;
+pthread_once_t HdfsConnectionPool::threadKeyOnce_ = PTHREAD_ONCE_INIT;
+
+
+
+HdfsConnectionPool* HdfsConnectionPool::instance()
+{
+  // Never destroyed: closing connections at exit may happen after the JVM is gone
+  static HdfsConnectionPool* pool = new HdfsConnectionPool();
+  return pool;
+}
+
+
+
+HdfsConnectionPool::HdfsConnectionPool(): maxIdle(32), idleTimeout(300), connectTimeout(60),
+  validateInterval(60), validatorStarted(false), connectors("connect", 4, 64)
+{
+  pthread_mutex_init(&this->mtx_, 0);
+  memset(&this->stats, 0, sizeof(this->stats));
+}
+
+
+
+HdfsConnectionPool::~HdfsConnectionPool()
+{
+  pthread_mutex_destroy(&this->mtx_);
+}
+
+
+
+void HdfsConnectionPool::setMaxIdle(unsigned maxIdle) throw ()
+{
+  HdfsLock l(&this->mtx_);
+  this->maxIdle = maxIdle;
+}
+
+
+
+void HdfsConnectionPool::setIdleTimeout(unsigned seconds) throw ()
+{
+  HdfsLock l(&this->mtx_);
+  this->idleTimeout = seconds;
+}
+
+
+
+void HdfsConnectionPool::setConnectTimeout(unsigned seconds) throw ()
+{
+  HdfsLock l(&this->mtx_);
+  this->connectTimeout = seconds;
+}
+
+
+
+void HdfsConnectionPool::setShortCircuit(const std::string& domainSocket) throw ()
+{
+#ifndef HAVE_HDFS_BUILDER
+  if (!domainSocket.empty())
+    Err(hdfslogname, "short-circuit reads need a libhdfs with hdfsBuilder, ignoring " << domainSocket);
+#endif
+  HdfsLock l(&this->mtx_);
+  this->domainSocket = domainSocket;
+}
+
+
+
+void HdfsConnectionPool::setValidateInterval(unsigned seconds) throw ()
+{
+  HdfsLock l(&this->mtx_);
+  this->validateInterval = seconds;
+}
+
+
+
+void HdfsConnectionPool::setConnectThreads(unsigned nThreads) throw ()
+{
+  this->connectors.setThreads(nThreads);
+}
+
+
+
+HdfsConnectionStats HdfsConnectionPool::getStats(void) throw ()
+{
+  HdfsLock l(&this->mtx_);
+  return this->stats;
+}
+
+
+
+void HdfsConnectionPool::createThreadKey(void)
+{
+  pthread_key_create(&threadKey_, destroyThreadContext);
+}
+
+
+
+void HdfsConnectionPool::destroyThreadContext(void* ctx)
+{
+  delete static_cast<ThreadContext*>(ctx);
+}
+
+
+
+HdfsConnectionPool::ThreadContext* HdfsConnectionPool::getThreadContext(void) throw ()
+{
+  pthread_once(&threadKeyOnce_, createThreadKey);
+
+  ThreadContext* ctx = static_cast<ThreadContext*>(pthread_getspecific(threadKey_));
+  if (!ctx) {
+    ctx = new ThreadContext();
+    pthread_setspecific(threadKey_, ctx);
+  }
+
+  return ctx;
+}
+
+
+
+void HdfsConnectionPool::expire(time_t now, std::deque<hdfsFS>& expired)
+{
+  std::map<Key, std::deque<IdleConnection> >::iterator i;
+
+  // Idle connections are kept ordered by release time, oldest first
+  for (i = this->idle_.begin(); i != this->idle_.end(); ++i) {
+    while (!i->second.empty() &&
+           now - i->second.front().since >= (time_t)this->idleTimeout) {
+      expired.push_back(i->second.front().fs);
+      i->second.pop_front();
+      this->stats.evictions++;
+      this->stats.idle--;
+    }
+  }
+}
+
+
+
+/// Connection opened by a connect thread
+class HdfsConnectionPool::ConnectTask: public HdfsTask {
+public:
+  ConnectTask(HdfsConnectionPool* pool, const Key& key):
+    pool(pool), key(key), fs(0), code(0) {}
+
+  void run(void)
+  {
+    try {
+      this->fs = this->pool->connectNow(this->key, this->endpoint);
+    }
+    catch (DmException& e) {
+      this->code    = e.code();
+      this->message = e.what();
+    }
+  }
+
+  // The caller is gone, keep the connection for the next one
+  void onAbandoned(void)
+  {
+    if (this->fs)
+      this->pool->adopt(this->key, this->fs, this->endpoint);
+  }
+
+  HdfsConnectionPool* pool;
+  Key         key;
+  Endpoint    endpoint;
+  hdfsFS      fs;
+  int         code;
+  std::string message;
+};
+
+
+
+hdfsFS HdfsConnectionPool::connect(const Key& key, Endpoint& endpoint) throw (DmException)
+{
+  unsigned timeout;
+  {
+    HdfsLock l(&this->mtx_);
+    timeout = this->connectTimeout;
+  }
+
+  if (timeout == 0)
+    return this->connectNow(key, endpoint);
+
+  ConnectTask* task = new ConnectTask(this, key);
+
+  if (!this->connectors.submit(task)) {
+    task->unref();
+    throw DmException(EBUSY, "Too many pending connections to Hdfs %s:%u",
+                      key.nameNode.c_str(), key.port);
+  }
+
+  if (!task->wait(timeout * 1000)) {
+    task->unref();
+    {
+      HdfsLock l(&this->mtx_);
+      this->stats.connectTimeouts++;
+    }
+    throw DmException(ETIMEDOUT, "Timed out after %u s connecting to Hdfs %s:%u",
+                      timeout, key.nameNode.c_str(), key.port);
+  }
+
+  hdfsFS      fs      = task->fs;
+  int         code    = task->code;
+  std::string message = task->message;
+  endpoint = task->endpoint;
+  task->unref();
+
+  if (!fs)
+    throw DmException(code, message);
+
+  return fs;
+}
+
+
+
+void HdfsConnectionPool::adopt(const Key& key, hdfsFS fs, const Endpoint& endpoint) throw ()
+{
+  {
+    HdfsLock l(&this->mtx_);
+    std::deque<IdleConnection>& idle = this->idle_[key];
+
+    this->stats.creates++;
+    if (idle.size() < this->maxIdle) {
+      IdleConnection c;
+      c.fs       = fs;
+      c.since    = time(NULL);
+      c.endpoint = endpoint;
+      idle.push_back(c);
+      this->stats.idle++;
+      return;
+    }
+    this->stats.evictions++;
+  }
+  hdfsDisconnect(fs);
+}
+
+
+
+HdfsConnectionPool::Endpoint HdfsConnectionPool::active(const Key& key) throw ()
+{
+  Endpoint endpoint;
+  endpoint.host = key.nameNode;
+  endpoint.port = key.port;
+
+  HdfsNameNodes* nameNodes = HdfsNameNodes::get(key.nameNode, key.port, key.user);
+  if (nameNodes)
+    nameNodes->getActive(endpoint.host, endpoint.port);
+
+  return endpoint;
+}
+
+
+
+hdfsFS HdfsConnectionPool::connectNow(const Key& key, Endpoint& endpoint) throw (DmException)
+{
+  std::string    host = key.nameNode;
+  unsigned       port = key.port;
+  HdfsNameNodes* nameNodes = HdfsNameNodes::get(key.nameNode, key.port, key.user);
+
+  if (nameNodes)
+    nameNodes->getActive(host, port);
+
+  Log(Logger::Lvl4, hdfslogmask, hdfslogname, "opening a new connection to " << host << ":" << port << " as " << key.user);
+
+  hdfsFS fs = this->open(host, port, key.user);
+
+  // Fail over to the next namenode straight away
+  if (!fs && nameNodes) {
+    nameNodes->reportFailure(host, port);
+    nameNodes->getActive(host, port);
+
+    Log(Logger::Lvl4, hdfslogmask, hdfslogname, "retrying the connection on " << host << ":" << port);
+    fs = this->open(host, port, key.user);
+  }
+
+  if (!fs)
+    throw DmException(DMLITE_SYSERR(errno),
+                      "Could not connect to Hdfs %s:%u", host.c_str(), port);
+
+  endpoint.host = host;
+  endpoint.port = port;
+  return fs;
+}
+
+
+
+hdfsFS HdfsConnectionPool::open(const std::string& host, unsigned port, const std::string& user) throw ()
+{
+#ifdef HAVE_HDFS_BUILDER
+  std::string domainSocket;
+  {
+    HdfsLock l(&this->mtx_);
+    domainSocket = this->domainSocket;
+  }
+
+  if (!domainSocket.empty()) {
+    struct hdfsBuilder* builder = hdfsNewBuilder();
+    hdfsBuilderSetForceNewInstance(builder);
+    hdfsBuilderSetNameNode(builder, host.c_str());
+    hdfsBuilderSetNameNodePort(builder, port);
+    hdfsBuilderSetUserName(builder, user.c_str());
+    // The client falls back to the remote reads on its own when the block is not local
+    hdfsBuilderConfSetStr(builder, "dfs.client.read.shortcircuit", "true");
+    hdfsBuilderConfSetStr(builder, "dfs.domain.socket.path", domainSocket.c_str());
+    return hdfsBuilderConnect(builder);
+  }
+#endif
+
+  return hdfsConnectAsUserNewInstance(host.c_str(), port, user.c_str());
+}
+
+
+
+void HdfsConnectionPool::flush(const std::string& nameNode) throw ()
+{
+  std::deque<hdfsFS> toClose;
+
+  {
+    HdfsLock l(&this->mtx_);
+
+    std::map<Key, std::deque<IdleConnection> >::iterator i;
+    for (i = this->idle_.begin(); i != this->idle_.end(); ++i) {
+      if (i->first.nameNode != nameNode)
+        continue;
+      while (!i->second.empty()) {
+        toClose.push_back(i->second.front().fs);
+        i->second.pop_front();
+        this->stats.evictions++;
+        this->stats.idle--;
+      }
+    }
+  }
+
+  for (std::deque<hdfsFS>::iterator j = toClose.begin(); j != toClose.end(); ++j)
+    hdfsDisconnect(*j);
+}
+
+
+
+hdfsFS HdfsConnectionPool::acquire(const std::string& nameNode, unsigned port,
+                                   const std::string& user) throw (DmException)
+{
+  Key key;
+  key.nameNode = nameNode;
+  key.port     = port;
+  key.user     = user;
+
+  hdfsFS fs = 0;
+  std::deque<hdfsFS> expired;
+  ThreadContext* ctx = this->getThreadContext();
+  Endpoint endpoint = this->active(key);
+
+  {
+    HdfsLock l(&this->mtx_);
+
+    if (this->validateInterval && !this->validatorStarted) {
+      pthread_t      thread;
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      if (pthread_create(&thread, &attr, runValidator, this) == 0)
+        this->validatorStarted = true;
+      pthread_attr_destroy(&attr);
+    }
+
+    this->expire(time(NULL), expired);
+
+    std::deque<IdleConnection>& idle = this->idle_[key];
+
+    // Close the connections left to a namenode which is not the active one anymore
+    for (std::deque<IdleConnection>::iterator i = idle.begin(); i != idle.end();) {
+      if (i->endpoint != endpoint) {
+        expired.push_back(i->fs);
+        i = idle.erase(i);
+        this->stats.evictions++;
+        this->stats.idle--;
+      }
+      else {
+        ++i;
+      }
+    }
+
+    // Prefer the connection this thread released last, if it is still idle
+    std::map<Key, hdfsFS>::iterator preferred = ctx->preferred.find(key);
+    if (preferred != ctx->preferred.end()) {
+      for (std::deque<IdleConnection>::iterator i = idle.begin(); i != idle.end(); ++i) {
+        if (i->fs == preferred->second) {
+          fs = i->fs;
+          idle.erase(i);
+          this->stats.affinityHits++;
+          break;
+        }
+      }
+    }
+
+    // Otherwise the most recently released connection, it is the most likely to be alive
+    if (!fs && !idle.empty()) {
+      fs = idle.back().fs;
+      idle.pop_back();
+    }
+
+    if (fs) {
+      this->stats.idle--;
+      this->stats.hits++;
+      this->stats.leased++;
+      this->leased_[fs].key      = key;
+      this->leased_[fs].endpoint = endpoint;
+    }
+    else {
+      this->stats.misses++;
+    }
+  }
+
+  for (std::deque<hdfsFS>::iterator i = expired.begin(); i != expired.end(); ++i)
+    hdfsDisconnect(*i);
+
+  if (fs) {
+    Log(Logger::Lvl4, hdfslogmask, hdfslogname, "reusing pooled connection to " << nameNode << ":" << port);
+    return fs;
+  }
+
+  fs = this->connect(key, endpoint);
+
+  HdfsLock l(&this->mtx_);
+  this->stats.creates++;
+  this->stats.leased++;
+  this->leased_[fs].key      = key;
+  this->leased_[fs].endpoint = endpoint;
+
+  return fs;
+}
+
+
+
+void HdfsConnectionPool::release(hdfsFS fs, bool broken, bool succeeded) throw ()
+{
+  if (!fs)
+    return;
+
+  std::deque<hdfsFS> toClose;
+  ThreadContext* ctx = this->getThreadContext();
+  HdfsNameNodes* nameNodes = 0;
+  Lease lease;
+
+  {
+    HdfsLock l(&this->mtx_);
+
+    std::map<hdfsFS, Lease>::iterator i = this->leased_.find(fs);
+    if (i == this->leased_.end()) {
+      // Not ours, just close it
+      toClose.push_back(fs);
+    }
+    else {
+      lease = i->second;
+      std::deque<IdleConnection>& idle = this->idle_[lease.key];
+      this->leased_.erase(i);
+      this->stats.leased--;
+
+      nameNodes = HdfsNameNodes::get(lease.key.nameNode, lease.key.port, lease.key.user);
+
+      // Do not keep a connection to a namenode which is not the active one anymore
+      if (broken || idle.size() >= this->maxIdle ||
+          (nameNodes && lease.endpoint != this->active(lease.key))) {
+        toClose.push_back(fs);
+        this->stats.evictions++;
+      }
+      else {
+        IdleConnection c;
+        c.fs       = fs;
+        c.since    = time(NULL);
+        c.endpoint = lease.endpoint;
+        idle.push_back(c);
+        this->stats.idle++;
+        ctx->preferred[lease.key] = fs;
+      }
+    }
+
+    this->expire(time(NULL), toClose);
+  }
+
+  for (std::deque<hdfsFS>::iterator j = toClose.begin(); j != toClose.end(); ++j)
+    hdfsDisconnect(*j);
+
+  // Outside of mtx_: a failure flushes the idle connections
+  if (nameNodes) {
+    if (broken)
+      nameNodes->reportFailure(lease.endpoint.host, lease.endpoint.port);
+    else if (succeeded)
+      nameNodes->reportSuccess(lease.endpoint.host, lease.endpoint.port);
+  }
+}
+
+
+
+void* HdfsConnectionPool::runWarmUp(void* arg)
+{
+  WarmUp* warmUp = static_cast<WarmUp*>(arg);
+  HdfsConnectionPool* pool = HdfsConnectionPool::instance();
+  std::vector<hdfsFS> connections;
+  struct timeval start, end;
+
+  gettimeofday(&start, NULL);
+
+  try {
+    // The first connection starts the JVM
+    for (unsigned i = 0; i < warmUp->nConnections; ++i)
+      connections.push_back(pool->acquire(warmUp->key.nameNode, warmUp->key.port, warmUp->key.user));
+
+    hdfsFileInfo* hInfo = hdfsGetPathInfo(connections[0], "/");
+    if (!hInfo)
+      throw DmException(DMLITE_SYSERR(errno), "Could not stat / on %s", warmUp->key.nameNode.c_str());
+    hdfsFreeFileInfo(hInfo, 1);
+
+    gettimeofday(&end, NULL);
+    Log(Logger::Lvl1, hdfslogmask, hdfslogname, "warm-up of " << warmUp->key.nameNode << ":" << warmUp->key.port
+        << " done in " << ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000)
+        << " ms with " << connections.size() << " connections");
+  }
+  catch (DmException& e) {
+    Err(hdfslogname, "warm-up of " << warmUp->key.nameNode << ":" << warmUp->key.port << " failed: " << e.what());
+  }
+
+  for (std::vector<hdfsFS>::iterator i = connections.begin(); i != connections.end(); ++i)
+    pool->release(*i);
+
+  delete warmUp;
+  return NULL;
+}
+
+
+
+void HdfsConnectionPool::warmUp(const std::string& nameNode, unsigned port, const std::string& user,
+                                unsigned nConnections) throw ()
+{
+  if (nConnections == 0)
+    return;
+
+  Key key;
+  key.nameNode = nameNode;
+  key.port     = port;
+  key.user     = user;
+
+  HdfsLock l(&this->mtx_);
+
+  if (!this->warmedUp_.insert(key).second)
+    return;
+
+  // Freed by the thread, which may outlive the caller
+  WarmUp* warmUp = new WarmUp();
+  warmUp->key          = key;
+  warmUp->nConnections = nConnections;
+
+  pthread_t      thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int err = pthread_create(&thread, &attr, runWarmUp, warmUp);
+  pthread_attr_destroy(&attr);
+
+  if (err) {
+    Err(hdfslogname, "could not start the warm-up thread: " << strerror(err));
+    delete warmUp;
+  }
+}
+
+
+
+void HdfsConnectionPool::validate(void) throw ()
+{
+  typedef std::map<Key, std::deque<IdleConnection> > IdleMap;
+  IdleMap checking;
+  std::deque<hdfsFS> toClose;
+  time_t now = time(NULL);
+
+  // Take out of the pool the connections idle since the last round,
+  // the most recently used ones are known to be good
+  {
+    HdfsLock l(&this->mtx_);
+
+    this->expire(now, toClose);
+
+    for (IdleMap::iterator i = this->idle_.begin(); i != this->idle_.end(); ++i) {
+      while (!i->second.empty() &&
+             now - i->second.front().since >= (time_t)this->validateInterval) {
+        checking[i->first].push_back(i->second.front());
+        i->second.pop_front();
+        this->stats.idle--;
+      }
+    }
+  }
+
+  for (std::deque<hdfsFS>::iterator j = toClose.begin(); j != toClose.end(); ++j)
+    hdfsDisconnect(*j);
+
+  for (IdleMap::iterator i = checking.begin(); i != checking.end(); ++i) {
+    std::deque<IdleConnection> alive;
+
+    for (std::deque<IdleConnection>::iterator c = i->second.begin(); c != i->second.end(); ++c) {
+      struct timeval start;
+      gettimeofday(&start, NULL);
+
+      hdfsFileInfo* hInfo = hdfsGetPathInfo(c->fs, "/");
+      uint64_t latency = (uint64_t)(HDFSUtil::elapsed(start) * 1000);
+
+      HdfsLock l(&this->mtx_);
+      this->stats.validations++;
+      this->stats.validationTime += latency;
+      if (latency > this->stats.maxValidationTime)
+        this->stats.maxValidationTime = latency;
+
+      if (hInfo) {
+        hdfsFreeFileInfo(hInfo, 1);
+        alive.push_back(*c);
+      }
+      else {
+        Log(Logger::Lvl1, hdfslogmask, hdfslogname, "closing dead connection to " << i->first.nameNode << ":" << i->first.port);
+        this->stats.validationFailures++;
+        this->stats.evictions++;
+        toClose.push_back(c->fs);
+      }
+    }
+
+    // Put them back in front, they are older than the ones released meanwhile
+    HdfsLock l(&this->mtx_);
+    std::deque<IdleConnection>& idle = this->idle_[i->first];
+    idle.insert(idle.begin(), alive.begin(), alive.end());
+    this->stats.idle += alive.size();
+  }
+
+  for (std::deque<hdfsFS>::iterator j = toClose.begin(); j != toClose.end(); ++j)
+    hdfsDisconnect(*j);
+
+  HdfsConnectionStats stats = this->getStats();
+  Log(Logger::Lvl4, hdfslogmask, hdfslogname, "validated idle connections, validations: " << stats.validations
+      << ", failures: " << stats.validationFailures
+      << ", avg latency: " << (stats.validations ? stats.validationTime / stats.validations : 0) << " us"
+      << ", max latency: " << stats.maxValidationTime << " us");
+  Log(Logger::Lvl4, hdfslogmask, hdfslogname, "connection pool hits: " << stats.hits
+      << " (" << stats.affinityHits << " on the thread's own connection), misses: " << stats.misses
+      << ", created: " << stats.creates << ", connect timeouts: " << stats.connectTimeouts
+      << ", evictions: " << stats.evictions << ", leased: " << stats.leased << ", idle: " << stats.idle);
+}
+
+
+
+void* HdfsConnectionPool::runValidator(void* arg)
+{
+  HdfsConnectionPool* pool = static_cast<HdfsConnectionPool*>(arg);
+
+  while (true) {
+    unsigned interval;
+    {
+      HdfsLock l(&pool->mtx_);
+      interval = pool->validateInterval;
+    }
+
+    if (interval == 0) {
+      sleep(60);
+      continue;
+    }
+
+    sleep(interval);
+    pool->validate();
+  }
+
+  return NULL;
+}
+
+
+
+HdfsConnection::HdfsConnection(const std::string& nameNode, unsigned port,
+                               const std::string& user) throw (DmException):
+  fs(0), broken(false), succeeded(false)
+{
+  this->fs = HdfsConnectionPool::instance()->acquire(nameNode, port, user);
+}
+
+
+
+HdfsConnection::~HdfsConnection()
+{
+  HdfsConnectionPool::instance()->release(this->fs, this->broken, this->succeeded);
+}
+
+
+
+bool HdfsConnection::check(bool ok) throw ()
+{
+  if (ok)
+    this->succeeded = true;
+  else if (HDFSUtil::isConnectionError(errno))
+    this->invalidate();
+  return ok;
+}
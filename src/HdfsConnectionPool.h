@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsConnectionPool.h
+/// @brief   process-wide pool of hdfsFS connections.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSCONNECTIONPOOL_H
+#define HDFSCONNECTIONPOOL_H
+
+#include <dmlite/cpp/exceptions.h>
+#include <hdfs.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include "HdfsWorkerPool.h"
+
+namespace dmlite {
+
+/// Scoped lock on a pthread mutex
+class HdfsLock {
+public:
+	HdfsLock(pthread_mutex_t* mp): mp(mp) { pthread_mutex_lock(mp); }
+	~HdfsLock() { pthread_mutex_unlock(mp); }
+private:
+	pthread_mutex_t* mp;
+};
+
+/// Counters kept by the connection pool
+struct HdfsConnectionStats {
+	uint64_t hits;      // leases served by an idle connection
+	uint64_t misses;    // leases which required a new connection
+	uint64_t creates;   // connections opened
+	uint64_t evictions; // idle connections closed (idle timeout, pool full or broken)
+	uint64_t leased;    // connections currently leased
+	uint64_t idle;      // connections currently idle in the pool
+	uint64_t affinityHits; // leases served by the connection last released by the same thread
+	uint64_t connectTimeouts; // connections given up after the connect deadline
+	uint64_t validations;     // idle connections checked by the validator
+	uint64_t validationFailures; // idle connections found dead, and closed
+	uint64_t validationTime;  // total time spent in the validation RPCs (us)
+	uint64_t maxValidationTime; // slowest validation RPC (us)
+};
+
+/// Pool of hdfsFS handles shared by all the plugin components,
+/// keyed by (namenode, port, user).
+/// Connections are leased with acquire() and given back with release();
+/// at most maxIdle connections per key are kept once released, and the
+/// ones left unused for more than idleTimeout seconds are closed.
+/// Each thread gets back the connection it released last when idle; the
+/// JVM attachment of the threads is left to libhdfs.
+/// A validator thread periodically checks the connections idle for more
+/// than validateInterval seconds with a cheap RPC, and closes the dead ones.
+/// With a list of namenodes, each connection remembers the namenode it was
+/// opened to, and the ones not pointing to the active namenode are closed
+/// instead of being reused. mtx_ may be held while taking the HdfsNameNodes
+/// lock, never the other way round.
+class HdfsConnectionPool {
+public:
+	static HdfsConnectionPool* instance();
+
+	hdfsFS acquire(const std::string& nameNode, unsigned port,
+			const std::string& user) throw (DmException);
+	/// A broken connection is closed, and its namenode reported as failing.
+	/// The namenode is reported as working only if an RPC succeeded on it
+	void   release(hdfsFS fs, bool broken = false, bool succeeded = false) throw ();
+
+	void setMaxIdle(unsigned maxIdle) throw ();
+	void setIdleTimeout(unsigned seconds) throw ();
+	/// New connections are opened by nThreads connect threads, and the callers
+	/// wait at most timeout seconds for them (0 connects in the caller thread)
+	void setConnectTimeout(unsigned seconds) throw ();
+	void setConnectThreads(unsigned nThreads) throw ();
+	/// 0 disables the validation of the idle connections
+	void setValidateInterval(unsigned seconds) throw ();
+	/// Enables the short-circuit local reads through the datanode domain
+	/// socket (empty disables them)
+	void setShortCircuit(const std::string& domainSocket) throw ();
+
+	HdfsConnectionStats getStats(void) throw ();
+
+	/// Closes the idle connections to the given namenode(s)
+	void flush(const std::string& nameNode) throw ();
+
+	/// Starts the JVM, opens nConnections pooled connections and issues a probe
+	/// RPC in a detached thread. Done only once per key, nobody waits for it.
+	void warmUp(const std::string& nameNode, unsigned port, const std::string& user,
+			unsigned nConnections) throw ();
+
+private:
+	HdfsConnectionPool();
+	~HdfsConnectionPool();
+
+	struct Key {
+		std::string nameNode;
+		unsigned    port;
+		std::string user;
+		bool operator < (const Key&) const;
+	};
+
+	/// Namenode a connection was opened to
+	struct Endpoint {
+		std::string host;
+		unsigned    port;
+		bool operator != (const Endpoint&) const;
+	};
+
+	struct IdleConnection {
+		hdfsFS   fs;
+		time_t   since;
+		Endpoint endpoint;
+	};
+
+	struct Lease {
+		Key      key;
+		Endpoint endpoint;
+	};
+
+	struct WarmUp {
+		Key      key;
+		unsigned nConnections;
+	};
+
+	/// Moves the expired idle connections to the given list. Called with mtx_ held.
+	void expire(time_t now, std::deque<hdfsFS>& expired);
+
+	/// The namenode new connections for the key go to
+	Endpoint active(const Key& key) throw ();
+
+	/// Opens a new connection within the connect deadline
+	hdfsFS connect(const Key& key, Endpoint& endpoint) throw (DmException);
+	/// Opens a new connection, to the active namenode if a list is configured
+	hdfsFS connectNow(const Key& key, Endpoint& endpoint) throw (DmException);
+	/// hdfsConnect, with the short-circuit settings if enabled
+	hdfsFS open(const std::string& host, unsigned port, const std::string& user) throw ();
+	/// Puts in the idle list a connection opened after its caller gave up
+	void adopt(const Key& key, hdfsFS fs, const Endpoint& endpoint) throw ();
+
+	class ConnectTask;
+
+	/// Checks the idle connections, and closes the expired ones
+	void validate(void) throw ();
+	static void* runValidator(void* arg);
+
+	static void* runWarmUp(void* arg);
+
+	/// Per thread preferred connections
+	struct ThreadContext {
+		std::map<Key, hdfsFS> preferred;
+	};
+
+	ThreadContext* getThreadContext(void) throw ();
+	static void createThreadKey(void);
+	static void destroyThreadContext(void* ctx);
+
+	static pthread_key_t  threadKey_;
+	static pthread_once_t threadKeyOnce_;
+
+	pthread_mutex_t mtx_;
+
+	std::set<Key> warmedUp_;
+
+	std::map<Key, std::deque<IdleConnection> > idle_;
+	std::map<hdfsFS, Lease> leased_;
+
+	unsigned maxIdle;
+	unsigned idleTimeout;
+	unsigned connectTimeout;
+	unsigned validateInterval;
+	bool     validatorStarted;
+	std::string domainSocket;
+
+	HdfsWorkerPool connectors;
+
+	HdfsConnectionStats stats;
+};
+
+/// Lease of a pooled connection, given back when going out of scope
+class HdfsConnection {
+public:
+	HdfsConnection(const std::string& nameNode, unsigned port,
+			const std::string& user) throw (DmException);
+	~HdfsConnection();
+
+	hdfsFS get(void) const { return fs; }
+
+	/// The connection is closed instead of being put back in the pool
+	void invalidate(void) { broken = true; }
+
+	/// Records how the last hdfs call went and returns ok. Called right
+	/// after a failure, the connection is invalidated if errno says so
+	bool check(bool ok) throw ();
+
+private:
+	HdfsConnection(const HdfsConnection&);
+	HdfsConnection& operator = (const HdfsConnection&);
+
+	hdfsFS fs;
+	bool   broken;
+	bool   succeeded;
+};
+
+};
+
+#endif // HDFSCONNECTIONPOOL_H
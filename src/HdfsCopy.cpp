@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsCopy.cpp
+/// @brief   copy of the upload temp files to hdfs.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <deque>
+#include <errno.h>
+#include <unistd.h>
+
+using namespace dmlite;
+
+unsigned HdfsCopy::bufferSize = 4 * 1024 * 1024;
+unsigned HdfsCopy::nBuffers   = 3;
+unsigned HdfsCopy::nThreads   = 4;
+
+
+
+void HdfsCopy::setBufferSize(unsigned size) throw ()
+{
+  bufferSize = size > 0 ? size : BUFF_SIZE;
+}
+
+
+
+void HdfsCopy::setBuffers(unsigned nBuffers) throw ()
+{
+  // One being written and at least one being read
+  HdfsCopy::nBuffers = nBuffers > 2 ? nBuffers : 2;
+}
+
+
+
+void HdfsCopy::setThreads(unsigned nThreads) throw ()
+{
+  HdfsCopy::nThreads = nThreads;
+  pool()->setThreads(nThreads);
+  pool()->setMaxQueue(nThreads > 0 ? nThreads : 1);
+}
+
+
+
+HdfsWorkerPool* HdfsCopy::pool(void)
+{
+  // Never freed, the workers run until the process exits.
+  // Shared by the concurrent closes, so the queue is kept short: a read
+  // which would wait behind the ones of the other copies runs inline
+  static HdfsWorkerPool* readers = new HdfsWorkerPool("copy", nThreads, nThreads > 0 ? nThreads : 1);
+  return readers;
+}
+
+
+
+HdfsCopy::Chunk::Chunk(int fd, off_t offset, size_t size):
+  fd(fd), offset(offset), size(size), queued(false), nRead(0), err(0)
+{
+}
+
+
+
+void HdfsCopy::Chunk::run(void)
+{
+  this->data.resize(this->size);
+
+  size_t done = 0;
+  while (done < this->size) {
+    ssize_t n = ::pread(this->fd, &this->data[done], this->size - done, this->offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      this->err   = errno;
+      this->nRead = -1;
+      return;
+    }
+    if (n == 0)
+      break;
+    done += n;
+  }
+  this->nRead = done;
+}
+
+
+
+HdfsCopy::Chunk* HdfsCopy::submit(int fd, off_t offset) throw ()
+{
+  Chunk* chunk  = new Chunk(fd, offset, bufferSize);
+  chunk->queued = pool()->submit(chunk);
+  if (!chunk->queued)
+    chunk->run();
+  return chunk;
+}
+
+
+
+int64_t HdfsCopy::copy(int fd, hdfsFS fs, hdfsFile file, HdfsChecksum* checksum) throw ()
+{
+  std::deque<Chunk*> chunks;
+  off_t   next   = 0;
+  int64_t copied = 0;
+  int     err    = 0;
+
+  for (unsigned i = 0; i < nBuffers; ++i) {
+    chunks.push_back(submit(fd, next));
+    next += chunks.back()->size;
+  }
+
+  while (!chunks.empty()) {
+    Chunk* chunk = chunks.front();
+    chunks.pop_front();
+    if (chunk->queued)
+      chunk->wait();
+
+    if (chunk->nRead < 0) {
+      err = chunk->err;
+      chunk->unref();
+      break;
+    }
+
+    // The next buffers are being read meanwhile
+    if (checksum)
+      checksum->update(&chunk->data[0], chunk->nRead);
+
+    ssize_t done = 0;
+    while (done < chunk->nRead) {
+      tSize n = hdfsWrite(fs, file, &chunk->data[done], chunk->nRead - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        err = errno ? errno : EIO;
+        break;
+      }
+      done += n;
+    }
+    copied += done;
+
+    bool last = (size_t)chunk->nRead < chunk->size;
+    chunk->unref();
+    if (err || last)
+      break;
+
+    chunks.push_back(submit(fd, next));
+    next += chunks.back()->size;
+  }
+
+  // Reads past the end, or after an error
+  while (!chunks.empty()) {
+    if (chunks.front()->queued)
+      chunks.front()->wait();
+    chunks.front()->unref();
+    chunks.pop_front();
+  }
+
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  return copied;
+}
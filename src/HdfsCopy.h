@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsCopy.h
+/// @brief   copy of the upload temp files to hdfs.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSCOPY_H
+#define HDFSCOPY_H
+
+#include <hdfs.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+#include "HdfsChecksum.h"
+#include "HdfsWorkerPool.h"
+
+namespace dmlite {
+
+/// Copies a local file to hdfs in large buffers. The next buffers are read
+/// from the local disk on the copy threads while the current one is
+/// written, so the disk reads and the network writes overlap. When the
+/// copy threads are busy with other uploads, the buffers are read inline.
+class HdfsCopy {
+public:
+	static void setBufferSize(unsigned size) throw ();
+	/// Buffers read ahead of the one being written, plus one
+	static void setBuffers(unsigned nBuffers) throw ();
+	static void setThreads(unsigned nThreads) throw ();
+
+	/// Copies fd from its start to the end of the hdfs file, updating checksum if not 0.
+	/// Returns the bytes copied, -1 on error with errno set.
+	static int64_t copy(int fd, hdfsFS fs, hdfsFile file, HdfsChecksum* checksum = 0) throw ();
+
+private:
+	/// One buffer read from the local file
+	class Chunk: public HdfsTask {
+	public:
+		Chunk(int fd, off_t offset, size_t size);
+		void run(void);
+
+		int     fd;
+		off_t   offset;
+		size_t  size;
+		bool    queued; // read by the copy threads, run inline otherwise
+		std::vector<char> data;
+		ssize_t nRead;
+		int     err;
+	};
+
+	static Chunk* submit(int fd, off_t offset) throw ();
+
+	static HdfsWorkerPool* pool(void);
+
+	static unsigned bufferSize;
+	static unsigned nBuffers;
+	static unsigned nThreads;
+};
+
+};
+
+#endif // HDFSCOPY_H
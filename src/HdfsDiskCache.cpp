@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsDiskCache.cpp
+/// @brief   local disk tier of the segment cache.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace dmlite;
+
+#define DISK_CACHE_MAGIC 0x48444331 // "HDC1"
+
+// Segments remembered for the second-hit admission, forgotten when full
+#define MAX_SEEN_SEGMENTS 100000
+
+pthread_mutex_t HdfsDiskCache::mtx_ = PTHREAD_MUTEX_INITIALIZER;
+bool        HdfsDiskCache::active   = false;
+std::string HdfsDiskCache::directory;
+uint64_t    HdfsDiskCache::capacity = 10ULL * 1024 * 1024 * 1024;
+uint64_t    HdfsDiskCache::used     = 0;
+
+std::map<std::string, HdfsDiskCache::Entry>    HdfsDiskCache::entries;
+std::list<std::string>                         HdfsDiskCache::lru;
+std::map<std::string, unsigned>                HdfsDiskCache::seen;
+
+
+
+void HdfsDiskCache::setDirectory(const std::string& directory) throw ()
+{
+  HdfsLock l(&mtx_);
+
+  HdfsDiskCache::directory = directory;
+  active = false;
+  entries.clear();
+  lru.clear();
+  seen.clear();
+  used = 0;
+
+  if (directory.empty())
+    return;
+
+  struct stat st;
+  if (stat(directory.c_str(), &st) != 0 && HDFSUtil::mkdirs(directory.c_str()) != 0) {
+    Err(hdfslogname, "could not create the disk cache folder " << directory << ": " << strerror(errno));
+    HdfsDiskCache::directory.clear();
+    return;
+  }
+
+  scan();
+  evict();
+  active = true;
+}
+
+
+
+void HdfsDiskCache::setCapacity(uint64_t bytes) throw ()
+{
+  HdfsLock l(&mtx_);
+  capacity = bytes;
+  evict();
+}
+
+
+
+bool HdfsDiskCache::enabled(void) throw ()
+{
+  return active;
+}
+
+
+
+std::string HdfsDiskCache::name(const std::string& path, off_t offset) throw ()
+{
+  // FNV-1a of the path, the header tells the colliding paths apart
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < path.size(); ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 1099511628211ULL;
+  }
+
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%016llx-%llx", (unsigned long long)hash, (unsigned long long)offset);
+  return buffer;
+}
+
+
+
+void HdfsDiskCache::insert(const std::string& name, uint64_t size) throw ()
+{
+  Entry& entry = entries[name];
+  entry.size = size;
+  lru.push_front(name);
+  entry.lru = lru.begin();
+  used += size;
+}
+
+
+
+void HdfsDiskCache::scan(void) throw ()
+{
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return;
+
+  // By last access, so the least recently used are evicted first
+  std::multimap<time_t, std::pair<std::string, uint64_t> > found;
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    std::string file = directory + "/" + entry->d_name;
+
+    // Leftovers of the stores interrupted by the previous run
+    if (strncmp(entry->d_name, ".tmp-", 5) == 0) {
+      unlink(file.c_str());
+      continue;
+    }
+    if (entry->d_name[0] == '.')
+      continue;
+
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+
+    found.insert(std::make_pair(st.st_atime, std::make_pair(std::string(entry->d_name), (uint64_t)st.st_size)));
+  }
+  closedir(dir);
+
+  std::multimap<time_t, std::pair<std::string, uint64_t> >::iterator i;
+  for (i = found.begin(); i != found.end(); ++i)
+    insert(i->second.first, i->second.second);
+
+  Log(Logger::Lvl1, hdfslogmask, hdfslogname, "disk cache " << directory << ": " << entries.size()
+      << " segments, " << used << " bytes");
+}
+
+
+
+void HdfsDiskCache::evict(void) throw ()
+{
+  while (used > capacity && !lru.empty()) {
+    std::map<std::string, Entry>::iterator oldest = entries.find(lru.back());
+    lru.pop_back();
+
+    // Readers which already mapped the file keep it until they are done
+    unlink((directory + "/" + oldest->first).c_str());
+    used -= oldest->second.size;
+    entries.erase(oldest);
+    HdfsIOStats::diskEvictions.add();
+  }
+}
+
+
+
+bool HdfsDiskCache::admit(const std::string& name) throw ()
+{
+  HdfsLock l(&mtx_);
+
+  std::map<std::string, unsigned>::iterator i = seen.find(name);
+  if (i != seen.end()) {
+    seen.erase(i);
+    return true;
+  }
+
+  if (seen.size() >= MAX_SEEN_SEGMENTS)
+    seen.clear();
+  seen[name] = 1;
+  return false;
+}
+
+
+
+bool HdfsDiskCache::load(const std::string& name, const std::string& path, time_t mtime,
+                         off_t fileSize, off_t offset, char* buffer, size_t size, size_t* nRead) throw ()
+{
+  std::string file;
+  {
+    HdfsLock l(&mtx_);
+    std::map<std::string, Entry>::iterator i = entries.find(name);
+    if (i == entries.end())
+      return false;
+    lru.splice(lru.begin(), lru, i->second.lru);
+    file = directory + "/" + name;
+  }
+
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (::fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (map == MAP_FAILED)
+    return false;
+
+  const Header* header = static_cast<const Header*>(map);
+  const char*   data   = static_cast<const char*>(map) + sizeof(Header) + header->pathLength;
+
+  // Stale if the hdfs file has changed since
+  bool valid = header->magic == DISK_CACHE_MAGIC &&
+               sizeof(Header) + header->pathLength + header->dataLength == (uint64_t)st.st_size &&
+               header->mtime == mtime && header->fileSize == fileSize && header->offset == offset &&
+               path.compare(0, std::string::npos, static_cast<const char*>(map) + sizeof(Header), header->pathLength) == 0;
+
+  if (valid) {
+    *nRead = std::min((size_t)header->dataLength, size);
+    memcpy(buffer, data, *nRead);
+  }
+
+  munmap(map, st.st_size);
+  return valid;
+}
+
+
+
+void HdfsDiskCache::store(const std::string& name, const std::string& path, time_t mtime,
+                          off_t fileSize, off_t offset, const char* buffer, size_t size) throw ()
+{
+  std::string dir;
+  {
+    HdfsLock l(&mtx_);
+    dir = directory;
+  }
+  if (dir.empty())
+    return;
+
+  std::stringstream tmp;
+  tmp << dir << "/.tmp-" << name << "-" << getpid() << "-" << pthread_self();
+
+  Header header;
+  header.magic      = DISK_CACHE_MAGIC;
+  header.pathLength = path.size();
+  header.mtime      = mtime;
+  header.fileSize   = fileSize;
+  header.offset     = offset;
+  header.dataLength = size;
+
+  int fd = ::open(tmp.str().c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  if (fd < 0)
+    return;
+
+  bool ok = ::write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+            ::write(fd, path.c_str(), path.size()) == (ssize_t)path.size() &&
+            ::write(fd, buffer, size) == (ssize_t)size;
+  ::close(fd);
+
+  // Renamed only once complete, so that a crash never leaves a partial segment
+  if (!ok || rename(tmp.str().c_str(), (dir + "/" + name).c_str()) != 0) {
+    unlink(tmp.str().c_str());
+    return;
+  }
+
+  HdfsLock l(&mtx_);
+  if (dir != directory)
+    return;
+
+  // Replaces the stale segment, if any
+  std::map<std::string, Entry>::iterator stale = entries.find(name);
+  if (stale != entries.end()) {
+    used -= stale->second.size;
+    lru.erase(stale->second.lru);
+    entries.erase(stale);
+  }
+  insert(name, sizeof(header) + path.size() + size);
+  HdfsIOStats::diskAdmissions.add();
+  evict();
+}
+
+
+
+tSize HdfsDiskCache::fetch(hdfsFS fs, hdfsFile file, const std::string& path,
+                           time_t mtime, off_t fileSize, off_t offset,
+                           char* buffer, size_t size) throw ()
+{
+  std::string segment = name(path, offset);
+
+  size_t nRead;
+  if (load(segment, path, mtime, fileSize, offset, buffer, size, &nRead)) {
+    HdfsIOStats::diskHits.add();
+    return nRead;
+  }
+  HdfsIOStats::diskMisses.add();
+
+  tSize n = HdfsReadAhead::preadFully(fs, file, offset, buffer, size);
+
+  // Only the complete segments are stored
+  if (n == (tSize)size && admit(segment))
+    store(segment, path, mtime, fileSize, offset, buffer, size);
+
+  return n;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsDiskCache.h
+/// @brief   local disk tier of the segment cache.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSDISKCACHE_H
+#define HDFSDISKCACHE_H
+
+#include <hdfs.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <list>
+#include <map>
+#include <string>
+
+namespace dmlite {
+
+/// File segments kept on a local disk (SSD) of the gateway, one cache file
+/// per segment, read through mmap. Each cache file records the path, the
+/// modification time and the length of the hdfs file it comes from, and is
+/// used only if they still match. A segment is stored the second time it is
+/// fetched from hdfs, and the least recently used ones are removed above the
+/// capacity. The files are found again when the gateway restarts.
+class HdfsDiskCache {
+public:
+	/// Empty disables the disk cache
+	static void setDirectory(const std::string& directory) throw ();
+	static void setCapacity(uint64_t bytes) throw ();
+
+	/// Set with the directory at configure time, read without the lock
+	static bool enabled(void) throw ();
+
+	/// Reads the segment at offset from the disk cache, or from hdfs
+	/// (storing it if admitted). Returns the bytes read, -1 on error.
+	static tSize fetch(hdfsFS fs, hdfsFile file, const std::string& path,
+			time_t mtime, off_t fileSize, off_t offset,
+			char* buffer, size_t size) throw ();
+
+private:
+	/// Header of the cache files, followed by the path and the data
+	struct Header {
+		uint32_t magic;
+		uint32_t pathLength;
+		int64_t  mtime;
+		int64_t  fileSize;
+		int64_t  offset;
+		uint64_t dataLength;
+	};
+
+	struct Entry {
+		uint64_t size; // of the cache file
+		std::list<std::string>::iterator lru;
+	};
+
+	static std::string name(const std::string& path, off_t offset) throw ();
+
+	static bool load(const std::string& name, const std::string& path, time_t mtime,
+			off_t fileSize, off_t offset, char* buffer, size_t size, size_t* nRead) throw ();
+	static void store(const std::string& name, const std::string& path, time_t mtime,
+			off_t fileSize, off_t offset, const char* buffer, size_t size) throw ();
+	/// Counts the fetches from hdfs, returns true on the second one
+	static bool admit(const std::string& name) throw ();
+
+	/// Indexes the cache files left by a previous run. Called with mtx_ held.
+	static void scan(void) throw ();
+	/// Called with mtx_ held
+	static void evict(void) throw ();
+	/// Indexes a cache file as the most recently used. Called with mtx_ held
+	static void insert(const std::string& name, uint64_t size) throw ();
+
+	static pthread_mutex_t mtx_;
+	static bool        active;
+	static std::string directory;
+	static uint64_t capacity;
+	static uint64_t used;
+
+	static std::map<std::string, Entry>    entries;
+	static std::list<std::string>          lru;  // most recently used first
+	static std::map<std::string, unsigned> seen; // segments fetched once, not stored yet
+};
+
+};
+
+#endif // HDFSDISKCACHE_H
@@ -10,30 +10,59 @@
  *
 */ 
 #include "Hdfs.h"
+#include "HdfsNS.h"
+#include <algorithm>
+#include <limits.h>
 #include <stdio.h>
 #include <time.h>
 #include <sstream>
 #include <string.h>
+#include <sys/time.h>
 
 using namespace dmlite;
 
+HdfsCounter HdfsIOStats::opens;
+HdfsCounter HdfsIOStats::opensSaved;
+HdfsCounter HdfsIOStats::readAheadHits;
+HdfsCounter HdfsIOStats::readAheadMisses;
+HdfsCounter HdfsIOStats::readAheadFetched;
+HdfsCounter HdfsIOStats::readAheadWasted;
+HdfsCounter HdfsIOStats::cacheHits;
+HdfsCounter HdfsIOStats::cacheMisses;
+HdfsCounter HdfsIOStats::cacheWaits;
+HdfsCounter HdfsIOStats::cacheEvictions;
+HdfsCounter HdfsIOStats::diskHits;
+HdfsCounter HdfsIOStats::diskMisses;
+HdfsCounter HdfsIOStats::diskAdmissions;
+HdfsCounter HdfsIOStats::diskEvictions;
+HdfsCounter HdfsIOStats::uploadsDirect;
+HdfsCounter HdfsIOStats::uploadsSpooled;
+HdfsCounter HdfsIOStats::uploadsFallback;
+HdfsCounter HdfsIOStats::uploadsSpilled;
+HdfsCounter HdfsIOStats::spoolMemory;
+HdfsCounter HdfsIOStats::writesReordered;
+HdfsCounter HdfsIOStats::reassemblySpilled;
+HdfsCounter HdfsIOStats::reassemblyMemory;
+
+
+
 HdfsIOHandler::HdfsIOHandler(HdfsIODriver* driver,
                                  const std::string& uri, 
-                                 int flags) throw (DmException):
-  driver(driver), path(uri),isWriting(false)
+                                 int flags,
+                                 unsigned bufferSize) throw (DmException):
+  driver(driver), fs(0), fsBroken(false), fsSucceeded(false), file(0), opened(false), ready(false), pos(0), readAhead(0),
+#ifdef HAVE_HADOOP_READ_ZERO
+  rzOptions(0),
+#endif
+  zeroCopyBytes(0), copiedBytes(0), path(uri),isWriting(false), streaming(false), failed(false), writePos(0),
+  reassembly(0), memSpool(0), checksum(0), temp_fd(-1)
 {
   int err;       
   std::string filename;
   //mutex 
   if ((err=pthread_mutex_init(&this->mtx_, 0)))   throw DmException(err, "Could not create a new mutex"); 
-  //connect to the cluster
-  Log(Logger::Lvl4,hdfslogmask,hdfslogname," Trying to open file" << uri.c_str());
-  
-  this->fs = hdfsConnectAsUserNewInstance(driver->nameNode.c_str(), driver->port, driver->uname.c_str());
 
-  if(!this->fs)
-   throw DmException(DMLITE_SYSERR(errno),
-                      "Could not open the Hdfs Filesystem");
+  Log(Logger::Lvl4,hdfslogmask,hdfslogname," Trying to open file" << uri.c_str());
 
   //remove the host info if present
   std::string uri_string = std::string(uri);
@@ -62,18 +91,16 @@ HdfsIOHandler::HdfsIOHandler(HdfsIODriver* driver,
   if (flags & O_WRONLY) {
        isWriting = true;
   } 
-  
-  // Try to open the hdfs file, map the errno to the DmException otherwise
-  this->file = hdfsOpenFile(this->fs, uri_string.c_str(), flags, 0, this->driver->replication, 0);
-  
-  if (!this->file)//workaround using ENOENT always
-    throw DmException(ENOENT, "Can not open the Hdfs file '%s'", uri_string.c_str());
 
-  Log(Logger::Lvl4,hdfslogmask,hdfslogname," opened file: "<< uri_string.c_str());
+  // The connection and the hdfs file are opened with the first I/O (see openFile)
+  this->hdfsPath  = uri_string;
+  this->openFlags  = flags;
+  this->bufferSize = bufferSize;
   
   this->isEof = false;
 
   //in case of write operation try to open the file used to buffer the call
+  strcpy(this->temp_path, "");
   if (this->isWriting) {
 	lk l(&this->mtx_);
 	//initilialize rand
@@ -82,56 +109,421 @@ HdfsIOHandler::HdfsIOHandler(HdfsIODriver* driver,
 	srand (time(NULL));
 	random =rand();
   	strs << random;
-	//create temp folder
-	struct stat st = {0};
 
         strcpy(this->temp_path,this->driver->tmpFolder.c_str());
         strcat(this->temp_path,"/hdfs-io-temp");
-
-	if (stat(this->temp_path, &st) == -1) {
- 	   if ( HDFSUtil::mkdirs(this->temp_path) == -1)
-		 throw DmException(errno, "Could not create the temp folder for writing %s", this->temp_path);
-        }
-
 	strcat(this->temp_path,"/temp");
 	strcat(this->temp_path,strs.str().c_str());
         strcat(this->temp_path,filename.c_str());
 
-	this->temp_fd = ::open(this->temp_path,O_CREAT|O_WRONLY, 0700);
-	Log(Logger::Lvl4,hdfslogmask,hdfslogname," opened temp file: "<< this->temp_path);
-	if (this->temp_fd == -1)
-	    throw DmException(errno, "Could not create the temp file for writing %s", this->temp_path);
+	// Computed as the data goes to hdfs, in order
+	if (HdfsChecksum::enabled())
+	  this->checksum = new HdfsChecksum();
 
+	// The direct uploads need the temp file only if they stop being sequential
+	if (this->driver->directWrite)
+	  this->streaming = true;
+	else
+	  this->openSpool();
    }
 
 }
 
 
 
+// The small uploads never touch the disk. Called with mtx_ held
+void HdfsIOHandler::openSpool(void) throw (DmException)
+{
+  if (HdfsMemorySpool::enabled())
+    this->memSpool = new HdfsMemorySpool();
+  else
+    this->openTempFile();
+}
+
+
+
+// Called with mtx_ held
+void HdfsIOHandler::openTempFile(void) throw (DmException)
+{
+  //create temp folder
+  struct stat st = {0};
+  std::string folder = this->driver->tmpFolder + "/hdfs-io-temp";
+
+  if (stat(folder.c_str(), &st) == -1) {
+    if (HDFSUtil::mkdirs(folder.c_str()) == -1)
+      throw DmException(errno, "Could not create the temp folder for writing %s", folder.c_str());
+  }
+
+  this->temp_fd = ::open(this->temp_path,O_CREAT|O_WRONLY, 0700);
+  Log(Logger::Lvl4,hdfslogmask,hdfslogname," opened temp file: "<< this->temp_path);
+  if (this->temp_fd == -1)
+    throw DmException(errno, "Could not create the temp file for writing %s", this->temp_path);
+}
+
+
+
+// Called with mtx_ held
+void HdfsIOHandler::spill(void) throw (DmException)
+{
+  Log(Logger::Lvl4,hdfslogmask,hdfslogname,"spilling " << this->memSpool->size()
+      << " bytes of " << this->path.c_str() << " to the temp file");
+
+  this->openTempFile();
+  if (!this->memSpool->writeTo(this->temp_fd))
+    throw DmException(errno, "Could not write the temp file %s", this->temp_path);
+
+  delete this->memSpool;
+  this->memSpool = 0;
+  HdfsIOStats::uploadsSpilled.add();
+}
+
+
+
+// Called with mtx_ held
+size_t HdfsIOHandler::spoolWrite(const char* buffer, size_t count, off_t offset) throw (DmException)
+{
+  if (this->memSpool) {
+    if (this->memSpool->write(buffer, count, offset))
+      return count;
+    // Too large for memory
+    this->spill();
+  }
+
+  ssize_t nbytes = ::pwrite(this->temp_fd, buffer, count, offset);
+
+  if (nbytes < 0) {
+    char errbuffer[128];
+    strerror_r(errno, errbuffer, sizeof(errbuffer));
+    throw DmException(errno, "%s", errbuffer);
+  }
+
+  return static_cast<size_t>(nbytes);
+}
+
+
+
+// Called with mtx_ held
+size_t HdfsIOHandler::writeAt(const char* buffer, size_t count, off_t offset) throw (DmException)
+{
+  if (this->failed)
+    throw DmException(EIO, "The upload of %s failed already", this->path.c_str());
+
+  if (this->streaming) {
+    this->openFile();
+    if (!this->reassembly)
+      this->reassembly = new HdfsReassembly(this->fs, this->file, std::string(this->temp_path) + ".gaps",
+                                            this->checksum);
+    // A failed write leaves a hole in hdfs, the upload is not committed then
+    try {
+      if (this->reassembly->write(buffer, count, offset))
+        return count;
+      // What is in hdfs already can not be rewritten
+      this->fallBackToSpool();
+    }
+    catch (...) {
+      this->failed = true;
+      throw;
+    }
+  }
+
+  return this->spoolWrite(buffer, count, offset);
+}
+
+
+
+// Called with mtx_ held
+off_t HdfsIOHandler::writtenSize(void) throw (DmException)
+{
+  if (this->streaming)
+    return this->reassembly ? this->reassembly->size() : 0;
+  if (this->memSpool)
+    return this->memSpool->size();
+
+  struct stat st;
+  if (::fstat(this->temp_fd, &st) != 0)
+    throw DmException(errno, "Could not stat the temp file %s", this->temp_path);
+  return st.st_size;
+}
+
+
+
+// The pending writes and the bytes streamed so far are moved to the spool,
+// and the file is written again from it at close. The upload stays streamed
+// until all of it is in the spool. Called with mtx_ held
+void HdfsIOHandler::fallBackToSpool(void) throw (DmException)
+{
+  off_t flushed = this->reassembly ? this->reassembly->flushed() : 0;
+
+  Log(Logger::Lvl4,hdfslogmask,hdfslogname,"write before the end of the data streamed to "
+      << this->path.c_str() << ", moving " << flushed << " bytes to the spool");
+
+  this->openSpool();
+
+  char buf[BUFF_SIZE];
+
+  if (this->reassembly) {
+    std::vector<HdfsReassembly::Range> ranges;
+    this->reassembly->getPending(ranges);
+
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      for (size_t done = 0; done < ranges[i].size; ) {
+        size_t n = std::min(ranges[i].size - done, sizeof(buf));
+        off_t  offset = ranges[i].offset + done;
+        this->reassembly->readPending(buf, n, offset);
+        for (size_t w = 0; w < n; )
+          w += this->spoolWrite(buf + w, n - w, offset + w);
+        done += n;
+      }
+    }
+  }
+
+  if (this->file) {
+    int ret = hdfsCloseFile(this->fs, this->file);
+    this->file = 0;
+    if (ret != 0)
+      throw DmException(EIO, "Could not close the Hdfs file %s", this->hdfsPath.c_str());
+  }
+
+  hdfsFile in = hdfsOpenFile(this->fs, this->hdfsPath.c_str(), O_RDONLY, 0, 0, 0);
+  if (!in)
+    throw DmException(EIO, "Could not reopen the Hdfs file %s", this->hdfsPath.c_str());
+
+  off_t done = 0;
+  while (done < flushed) {
+    tSize n = hdfsRead(this->fs, in, buf, std::min((off_t)sizeof(buf), flushed - done));
+    if (n <= 0)
+      break;
+    try {
+      for (tSize w = 0; w < n; )
+        w += this->spoolWrite(buf + w, n - w, done + w);
+    }
+    catch (...) {
+      hdfsCloseFile(this->fs, in);
+      throw;
+    }
+    done += n;
+  }
+  hdfsCloseFile(this->fs, in);
+
+  if (done != flushed)
+    throw DmException(EIO, "Could not read back the Hdfs file %s", this->hdfsPath.c_str());
+
+  delete this->reassembly;
+  this->reassembly = 0;
+  this->streaming  = false;
+  HdfsIOStats::uploadsFallback.add();
+
+  // The whole file is written again
+  if (this->checksum) {
+    delete this->checksum;
+    this->checksum = new HdfsChecksum();
+  }
+}
+
+
+
 HdfsIOHandler::~HdfsIOHandler()
 {
+  // Stop the prefetches before closing the file
+  delete this->readAhead;
+  delete this->reassembly;
+
+#ifdef HAVE_HADOOP_READ_ZERO
+  if (this->rzOptions)
+    hadoopRzOptionsFree(this->rzOptions);
+#endif
+
   // Close the file if its still open
   if(this->file)
     hdfsCloseFile(this->fs, this->file);
   
-  hdfsDisconnect(this->fs);
+  this->releaseFs();
+
+  if (!this->opened)
+    HdfsIOStats::opensSaved.add();
 
   //close and remove the temp file
+  delete this->memSpool;
+  delete this->checksum;
   if(this->isWriting) {
-	  if (this->temp_fd != -1)
+	  if (this->temp_fd != -1) {
 	    ::close(this->temp_fd);
-          ::remove(this->temp_path);
+            ::remove(this->temp_path);
+	  }
 	  strcpy(this->temp_path, "");
 	  this->temp_fd = -1;
   }
   pthread_mutex_destroy(&this->mtx_); 
 
-  Log(Logger::Lvl4,hdfslogmask,hdfslogname,"closed file");
+  if (this->driver->zeroCopy)
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname,"bytes read with zero copy: " << this->zeroCopyBytes
+        << ", copied: " << this->copiedBytes);
+
+  Log(Logger::Lvl4,hdfslogmask,hdfslogname,"closed file, hdfs opens: " << HdfsIOStats::opens.get()
+      << ", saved by lazy open: " << HdfsIOStats::opensSaved.get());
+
+  if (this->isWriting) {
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname,"uploads streamed: " << HdfsIOStats::uploadsDirect.get()
+        << ", spooled: " << HdfsIOStats::uploadsSpooled.get() << " ("
+        << HdfsIOStats::uploadsFallback.get() << " after a non sequential write, "
+        << HdfsIOStats::uploadsSpilled.get() << " spilled from memory), spool memory in use: "
+        << HdfsIOStats::spoolMemory.get() << ", writes reordered: " << HdfsIOStats::writesReordered.get()
+        << " (" << HdfsIOStats::reassemblySpilled.get() << " bytes through the gap files, "
+        << HdfsIOStats::reassemblyMemory.get() << " bytes in memory)");
+  }
+
+  if (HdfsAdmission::enabled()) {
+    HdfsAdmissionStats admission = HdfsAdmission::get(this->driver->nameNode)->getStats();
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname,"namenode operations admitted: " << admission.admitted
+        << ", queued: " << admission.waited << " (" << admission.queued << " now, at most " << admission.maxQueued
+        << "), timeouts: " << admission.timeouts << ", avg wait: "
+        << (admission.waited ? admission.waitTime / admission.waited : 0) << " us, max wait: "
+        << admission.maxWaitTime << " us");
+  }
+
+  if (HdfsBlockCache::enabled()) {
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname,"block cache hits: " << HdfsIOStats::cacheHits.get()
+        << " (" << HdfsIOStats::cacheWaits.get() << " waiting for a fetch), misses: "
+        << HdfsIOStats::cacheMisses.get() << ", evictions: " << HdfsIOStats::cacheEvictions.get());
+  }
+
+  if (HdfsDiskCache::enabled()) {
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname,"disk cache hits: " << HdfsIOStats::diskHits.get()
+        << ", misses: " << HdfsIOStats::diskMisses.get() << ", stored: " << HdfsIOStats::diskAdmissions.get()
+        << ", evictions: " << HdfsIOStats::diskEvictions.get());
+  }
+
+  if (HdfsReadAhead::enabled()) {
+    uint64_t hits   = HdfsIOStats::readAheadHits.get();
+    uint64_t misses = HdfsIOStats::readAheadMisses.get();
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname,"read-ahead hit rate: "
+        << (hits + misses ? 100 * hits / (hits + misses) : 0) << "%, prefetched bytes: "
+        << HdfsIOStats::readAheadFetched.get() << ", wasted: " << HdfsIOStats::readAheadWasted.get());
+  }
 
 }
 
 
 
+bool HdfsIOHandler::checkFs(bool ok) throw ()
+{
+  if (ok)
+    this->fsSucceeded = true;
+  else if (HDFSUtil::isConnectionError(errno))
+    this->fsBroken = true;
+  return ok;
+}
+
+
+
+void HdfsIOHandler::releaseFs(void) throw ()
+{
+  if (this->fs)
+    HdfsConnectionPool::instance()->release(this->fs, this->fsBroken, this->fsSucceeded);
+  this->fs = 0;
+  this->fsBroken = this->fsSucceeded = false;
+}
+
+
+
+// Small buffers for the random reads, large ones for streaming large files
+unsigned HdfsIOHandler::chooseBufferSize(AccessHint hint) throw ()
+{
+  if (this->bufferSize || this->isWriting)
+    return this->bufferSize;
+
+  off_t size;
+  switch (hint) {
+    case kAccessRandom:
+      size = this->driver->readBufferMin;
+      break;
+    case kAccessSequential:
+      size = this->fileStat.st_size / 16;
+      break;
+    default:
+      size = BUFF_SIZE;
+  }
+
+  size = std::min(std::max(size, (off_t)this->driver->readBufferMin), (off_t)this->driver->readBufferMax);
+  // No need to buffer more than the file, even for the random reads
+  size = std::min(size, this->fileStat.st_size);
+  size = (size + 4095) & ~4095;
+
+  // hdfsOpenFile takes a tSize
+  return (unsigned)std::min(size, (off_t)(INT_MAX & ~4095));
+}
+
+
+
+// Connect and open the hdfs file, done on the first I/O. Called with mtx_ held
+void HdfsIOHandler::openFile(AccessHint hint) throw (DmException)
+{
+  if (this->file)
+    return;
+
+  // Wait for our turn if the namenode is busy
+  HdfsAdmissionTicket ticket(driver->nameNode);
+
+  //connect to the cluster
+  if (!this->fs)
+    this->fs = HdfsConnectionPool::instance()->acquire(driver->nameNode, driver->port, driver->uname);
+
+  // The size and times are read once, EOF, SEEK_END and fstat use them afterwards
+  if (!this->isWriting) {
+    hdfsFileInfo* hInfo = hdfsGetPathInfo(this->fs, this->hdfsPath.c_str());
+    if (!this->checkFs(hInfo != 0) || hInfo->mKind != kObjectKindFile) {
+      if (hInfo)
+        hdfsFreeFileInfo(hInfo, 1);
+      this->releaseFs();
+      throw DmException(ENOENT, "Can not open the Hdfs file '%s'", this->hdfsPath.c_str());
+    }
+
+    memset(&this->fileStat, 0, sizeof(this->fileStat));
+    this->fileStat.st_mode    = S_IFREG | hInfo->mPermissions;
+    this->fileStat.st_nlink   = 1;
+    this->fileStat.st_size    = hInfo->mSize;
+    this->fileStat.st_blksize = hInfo->mBlockSize;
+    this->fileStat.st_blocks  = (hInfo->mSize + 511) / 512;
+    this->fileStat.st_atime   = hInfo->mLastAccess;
+    this->fileStat.st_mtime   = hInfo->mLastMod;
+    this->fileStat.st_ctime   = hInfo->mLastMod;
+    hdfsFreeFileInfo(hInfo, 1);
+  }
+
+  // Try to open the hdfs file, map the errno to the DmException otherwise
+  unsigned bufferSize = this->chooseBufferSize(hint);
+  this->file = hdfsOpenFile(this->fs, this->hdfsPath.c_str(), this->openFlags, bufferSize, this->driver->replication, 0);
+  
+  if (!this->checkFs(this->file != 0)) {//workaround using ENOENT always
+    this->releaseFs();
+    throw DmException(ENOENT, "Can not open the Hdfs file '%s'", this->hdfsPath.c_str());
+  }
+
+  this->opened = true;
+  HdfsIOStats::opens.add();
+  Log(Logger::Lvl4,hdfslogmask,hdfslogname,"buffer size for " << this->hdfsPath << ": " << bufferSize);
+
+  // The block cache reads ahead by whole segments already
+  if (!this->isWriting && HdfsReadAhead::enabled() && !HdfsBlockCache::enabled())
+    this->readAhead = new HdfsReadAhead(this->fs, this->file, this->fileStat.st_size);
+
+#ifdef HAVE_HADOOP_READ_ZERO
+  // No byte buffer pool: the reads which can not be mmapped fail, and go through hdfsRead
+  if (!this->isWriting && this->driver->zeroCopy) {
+    this->rzOptions = hadoopRzOptionsAlloc();
+    if (this->rzOptions && this->driver->zeroCopySkipChecksum)
+      hadoopRzOptionsSetSkipChecksum(this->rzOptions, 1);
+  }
+#endif
+
+  // Publish fs and file to the lock-free preads
+  __sync_synchronize();
+  this->ready = true;
+  Log(Logger::Lvl4,hdfslogmask,hdfslogname," opened file: "<< this->hdfsPath.c_str());
+}
+
+
+
 void HdfsIOHandler::close(void) throw (DmException)
 {
 
@@ -139,24 +531,95 @@ void HdfsIOHandler::close(void) throw (DmException)
   Log(Logger::Lvl4,hdfslogmask,hdfslogname,"closing file "  << this->path.c_str()) ;
   int ret = 0;
   //in case of write operation write the file to hdfs
-  if (this->isWriting) {
+  if (this->isWriting && this->failed) {
+	// Neither the stream nor the spool has all the data
+	ret = -1;
+  }
+  else if (this->isWriting && this->streaming) {
+	lk l(&this->mtx_);
+	// Creates the file if nothing was written
+	this->openFile();
+	try {
+	  if (this->reassembly)
+	    this->reassembly->finish();
+	  ret = hdfsCloseFile(this->fs, this->file);
+	  this->checkFs(ret == 0);
+	  this->file = 0;
+	  HdfsIOStats::uploadsDirect.add();
+	}
+	catch (DmException&) {
+	  // Cleaned up below, the upload is refused
+	  this->failed = true;
+	  ret = -1;
+	}
+  }
+  else if (this->isWriting) {
 	ret = this->copyToHDFS();
+	HdfsIOStats::uploadsSpooled.add();
   }
 
-  if(this->file)
-    hdfsCloseFile(this->fs, this->file);
+  this->ready = false;
+  __sync_synchronize();
+
+  delete this->readAhead;
+  this->readAhead = 0;
+
+#ifdef HAVE_HADOOP_READ_ZERO
+  if (this->rzOptions)
+    hadoopRzOptionsFree(this->rzOptions);
+  this->rzOptions = 0;
+#endif
+
+  // Completes the spooled upload on the namenode
+  if(this->file) {
+    int closed = hdfsCloseFile(this->fs, this->file);
+    if (this->isWriting)
+      this->checkFs(closed == 0);
+  }
   this->file = 0;
 
+  if (this->isWriting && this->checksum && ret == 0)
+    this->storeChecksum();
+
+  this->releaseFs();
+
+  delete this->reassembly;
+  this->reassembly = 0;
+  delete this->memSpool;
+  this->memSpool = 0;
+
   //close the temp file for writing operataions and remove the temp file
-  if(this->isWriting) {
+  if(this->isWriting && this->temp_fd != -1) {
          ::close(this->temp_fd);
          this->temp_fd = -1;
 	 ::remove(this->temp_path);
   }
 
+  if (this->isWriting && this->failed)
+	throw DmException(EIO, "The upload of %s failed, not copied to HDFS", this->hdfsPath.c_str());
+  if (this->isWriting && this->streaming && ret != 0)
+	throw DmException(EIO, "Could not close the Hdfs file %s", this->hdfsPath.c_str());
   if (this->isWriting && (ret==-1))
-	throw DmException(EIO, "Could not copy the temp file to HDFS %s", this->temp_path);
+	throw DmException(EIO, "Could not copy the upload to HDFS %s", this->hdfsPath.c_str());
+
+}
+
 
+
+// Errors are only logged, the upload is fine without its checksums
+void HdfsIOHandler::storeChecksum(void) throw ()
+{
+  std::map<std::string, std::string> values;
+  this->checksum->final(values);
+
+  try {
+    HdfsChecksum::store(this->fs, this->hdfsPath, this->checksum->size(), values);
+    HdfsChecksum::remember(this->hdfsPath, values);
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname,"stored the checksums of " << this->path.c_str());
+  }
+  catch (DmException& e) {
+    Err(hdfslogname, "Could not store the checksums of " << this->path.c_str() << ": " << e.what());
+  }
 }
 
 
@@ -164,11 +627,28 @@ void HdfsIOHandler::close(void) throw (DmException)
 size_t HdfsIOHandler::read(char* buffer, size_t count) throw (DmException)
 {
 	lk l(&this->mtx_);
-	size_t bytes_read = hdfsRead(this->fs, this->file, buffer, count);
- 
-        //EOF flag is returned if the number of bytes read is lesser than the HDFS BUFSIZE
-  	if (bytes_read < BUFF_SIZE)
-  		this->isEof = true;
+	this->openFile(kAccessSequential);
+
+	tSize bytes_read;
+	if (HdfsBlockCache::enabled()) {
+		bytes_read = HdfsBlockCache::read(this->fs, this->file, this->hdfsPath, this->fileStat,
+		                                  buffer, count, this->pos);
+	}
+	else if (this->readAhead) {
+		// Prefetched according to the access pattern, short only at the end of the file
+		bytes_read = this->readAhead->read(buffer, count, this->pos);
+	}
+	else {
+		bytes_read = this->readStream(buffer, count);
+	}
+
+	if (bytes_read < 0)
+		throw DmException(EIO, "Could not read from the file %s", this->path.c_str());
+	this->pos += bytes_read;
+
+	// A short read is not the end of the file, hdfs stops at the block boundaries
+	if (bytes_read == 0 || this->pos >= this->fileStat.st_size)
+		this->isEof = true;
 	
         Log(Logger::Lvl4,hdfslogmask,hdfslogname,"reading " << bytes_read << " bytes from file " << this->path.c_str() << ", requested bytes " << count);
 	
@@ -177,19 +657,69 @@ size_t HdfsIOHandler::read(char* buffer, size_t count) throw (DmException)
 
 
 
+// Called with mtx_ held
+tSize HdfsIOHandler::readStream(char* buffer, size_t count) throw ()
+{
+#ifdef HAVE_HADOOP_READ_ZERO
+  if (this->rzOptions) {
+    size_t done = 0;
+
+    // The zero copy reads stop at the block boundaries
+    while (done < count) {
+      struct hadoopRzBuffer* rz = hadoopReadZero(this->file, this->rzOptions, count - done);
+      if (!rz)
+        break; // Not mmappable (remote or checksummed block), read it the usual way
+
+      int32_t n = hadoopRzBufferLength(rz);
+      if (n > 0)
+        memcpy(buffer + done, hadoopRzBufferGet(rz), n);
+      hadoopRzBufferFree(this->file, rz);
+
+      if (n <= 0)
+        return done;
+      done += n;
+      this->zeroCopyBytes += n;
+    }
+
+    if (done == count)
+      return done;
+
+    tSize n = hdfsRead(this->fs, this->file, buffer + done, count - done);
+    if (n < 0)
+      return done ? (tSize)done : -1;
+    this->copiedBytes += n;
+    return done + n;
+  }
+#endif
+
+  tSize n = hdfsRead(this->fs, this->file, buffer, count);
+  if (n > 0)
+    this->copiedBytes += n;
+  return n;
+}
+
+
+
 // Write a chunk of a file in a HDFS FS
 size_t HdfsIOHandler::write(const char* buffer, size_t count) throw (DmException){
         Log(Logger::Lvl4,hdfslogmask,hdfslogname,"writing " << count << " bytes to  file " << this->path.c_str());
         lk l(&this->mtx_);
-	ssize_t nbytes = ::write(this->temp_fd, buffer, count);
- 
-         if (nbytes < 0) {
-	    char errbuffer[128];
-	    strerror_r(errno, errbuffer, sizeof(errbuffer));
-	    throw DmException(errno, "%s", errbuffer);
-	  }
- 
-	return static_cast<size_t>(nbytes);
+
+	size_t n = this->writeAt(buffer, count, this->writePos);
+	this->writePos += n;
+	return n;
+}
+
+
+
+size_t HdfsIOHandler::pwrite(const void* buffer, size_t count, off_t offset) throw (DmException){
+        Log(Logger::Lvl4,hdfslogmask,hdfslogname,"writing " << count << " bytes to  file " << this->path.c_str() << " at offset " << offset);
+        if (!this->isWriting)
+          throw DmException(EBADF, "File %s not open for writing", this->path.c_str());
+
+        // The parallel streams of an upload arrive here out of order
+        lk l(&this->mtx_);
+        return this->writeAt((const char*)buffer, count, offset);
 }
 
 // Write a chunk of a file in a HDFS FS
@@ -202,47 +732,38 @@ size_t HdfsIOHandler::writeToHDFS(const char* buffer, size_t count) throw (DmExc
 
 int HdfsIOHandler::copyToHDFS(void) throw (DmException) {
     int fd_from;
-    char buf[8096];
-    ssize_t nread;
     int saved_errno;
     lk l(&this->mtx_); 
+    this->openFile();
+
+    if (this->memSpool) {
+        if (!this->memSpool->writeTo(this->fs, this->file, this->checksum))
+            return -1;
+        Log(Logger::Lvl4,hdfslogmask,hdfslogname,"Succesfully written file, " << this->memSpool->size()
+            << " bytes from memory");
+        return 0;
+    }
+
     fd_from = ::open(this->temp_path, O_RDONLY);
     if (fd_from < 0)
         return -1;
 
-    while (nread = ::read(fd_from, buf, sizeof buf), nread > 0)
-    {
-        char *out_ptr = buf;
-        ssize_t nwritten;
-
-        do {
-            nwritten = this->writeToHDFS(out_ptr,nread);
-
-            if (nwritten >= 0)
-            {
-                nread -= nwritten;
-                out_ptr += nwritten;
-            }
-            else if (errno != EINTR)
-            {
-                goto out_error;
-            }
-        } while (nread > 0);
-    }
-
-    if (nread == 0)
-    {
-        ::close(fd_from);
-        /* Success! */
-        Log(Logger::Lvl4,hdfslogmask,hdfslogname,"Succesfully written file");
-	return 0;
-    }
+    // The temp file is read ahead while it is written to hdfs
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    int64_t copied = HdfsCopy::copy(fd_from, this->fs, this->file, this->checksum);
 
-  out_error:
     saved_errno = errno;
     ::close(fd_from);
-    errno = saved_errno;
-    return -1;
+    if (copied < 0) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    /* Success! */
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname,"Succesfully written file, " << copied
+        << " bytes in " << HDFSUtil::elapsed(start) << " ms");
+    return 0;
 }
 
 // Position the reader pointer to the desired offset
@@ -251,12 +772,22 @@ void HdfsIOHandler::seek(off_t offset, Whence whence) throw (DmException){
         long positionToSet = 0;
 
 	if (this->isWriting) {
-		if (::lseek64(this->temp_fd, offset, whence) == ((off_t) - 1))
-		    throw DmException(errno, "Could not seek");
-                Log(Logger::Lvl4,hdfslogmask,hdfslogname,"seeking to offset " << offset << " for  file " << this->path.c_str());
+		// Only moves the cursor, the writes are reordered or spooled
+		lk l(&this->mtx_);
+		off_t target = offset;
+		if (whence == SEEK_CUR)
+		  target += this->writePos;
+		else if (whence == SEEK_END)
+		  target += this->writtenSize();
+		if (target < 0)
+		  throw DmException(EINVAL, "Could not seek");
+		this->writePos = target;
+                Log(Logger::Lvl4,hdfslogmask,hdfslogname,"seeking to offset " << target << " for  file " << this->path.c_str());
 	} else {
 
 	    lk l(&this->mtx_);
+	    // Seeking anywhere but the start before reading is the sign of random reads
+	    this->openFile((whence == SEEK_SET && offset == 0) ? kAccessUnknown : kAccessRandom);
 	    // Whence described from where the offset has to be set (begin, current or end)
 	    switch(whence)
 		{
@@ -264,16 +795,22 @@ void HdfsIOHandler::seek(off_t offset, Whence whence) throw (DmException){
 			positionToSet = offset;
 			break;	
 	    case SEEK_CUR:
-    			positionToSet = (this->tell() + offset);
+    			positionToSet = this->pos + offset;
     			break;
 	    case SEEK_END :
-			positionToSet = (hdfsAvailable(this->fs, this->file) - offset);
+			positionToSet = this->fileStat.st_size + offset;
 			break;
 		default:
                   break;
 		}
 
-   	    hdfsSeek(this->fs, this->file, positionToSet);
+	    // The read-ahead reads at the cursor, the hdfs stream is not used
+	    if (this->readAhead)
+		this->readAhead->seek(positionToSet);
+	    else
+		hdfsSeek(this->fs, this->file, positionToSet);
+	    this->pos   = positionToSet;
+	    this->isEof = false;
             Log(Logger::Lvl4,hdfslogmask,hdfslogname,"seeking to offset " << positionToSet << " for  file " << this->path.c_str());
 	
        }
@@ -285,7 +822,10 @@ off_t HdfsIOHandler::tell(void) throw (DmException){
 
         Log(Logger::Lvl4,hdfslogmask,hdfslogname,"file " << this->path.c_str());
         lk l(&this->mtx_);
-	return hdfsTell(this->fs, this->file);
+	if (this->isWriting)
+		return this->writePos;
+	this->openFile();
+	return this->pos;
 }
 
 
@@ -293,7 +833,10 @@ off_t HdfsIOHandler::tell(void) throw (DmException){
 void HdfsIOHandler::flush(void) throw (DmException){
 
  	Log(Logger::Lvl4,hdfslogmask,hdfslogname,"file " << this->path.c_str());
-	hdfsFlush(this->fs, this->file);
+	lk l(&this->mtx_);
+	// Nothing to flush if the file has not been opened yet
+	if (this->file)
+		hdfsFlush(this->fs, this->file);
 }
 
 
@@ -304,18 +847,65 @@ bool HdfsIOHandler::eof(void) throw (DmException){
 
 size_t HdfsIOHandler::pread(void* buffer, size_t count, off_t offset) throw (DmException){
 	
-      lk l(&this->mtx_);
+      // hdfsPread does not move the stream cursor, so once the file is open
+      // the preads run concurrently, without taking mtx_
+      if (!this->ready) {
+        lk l(&this->mtx_);
+        this->openFile(kAccessRandom);
+      }
+      __sync_synchronize();
+
       Log(Logger::Lvl4,hdfslogmask,hdfslogname,"read " << count << " bytes from file " << this->path.c_str() << " at offset " << offset);
-      size_t n;
-      n = hdfsPread(this->fs, this->file,offset, (char*)buffer, count);
+      tSize n;
+      if (HdfsBlockCache::enabled())
+        n = HdfsBlockCache::read(this->fs, this->file, this->hdfsPath, this->fileStat,
+                                 (char*)buffer, count, offset);
+      else if (this->readAhead)
+        n = this->readAhead->read((char*)buffer, count, offset, true);
+      else
+        n = hdfsPread(this->fs, this->file, offset, (char*)buffer, count);
+      if (n < 0)
+        throw DmException(EIO, "Could not read from the file %s at offset %ld", this->path.c_str(), (long)offset);
       return n;
 
 }
 
+size_t HdfsIOHandler::preadv(std::vector<HdfsReadChunk>& chunks) throw (DmException){
+
+      // Lock-free once the file is open, as pread
+      if (!this->ready) {
+        lk l(&this->mtx_);
+        this->openFile(kAccessRandom);
+      }
+      __sync_synchronize();
+
+      Log(Logger::Lvl4,hdfslogmask,hdfslogname,"readv of " << chunks.size() << " ranges from file " << this->path.c_str());
+      return HdfsVectorRead::read(this->fs, this->file, chunks);
+}
+
+
+
 struct stat HdfsIOHandler::fstat(void) throw (DmException){
 
+      lk l(&this->mtx_);
       struct stat st;
-      st.st_size = hdfsAvailable(this->fs, this->file);
+
+      // What has been written so far is in hdfs, in memory or in the temp file
+      if (this->isWriting && (this->streaming || this->memSpool)) {
+        memset(&st, 0, sizeof(st));
+        st.st_mode  = S_IFREG | 0700;
+        st.st_nlink = 1;
+        st.st_size  = this->writtenSize();
+      }
+      else if (this->isWriting) {
+        if (::fstat(this->temp_fd, &st) != 0)
+          throw DmException(errno, "Could not stat the temp file %s", this->temp_path);
+      }
+      else {
+        this->openFile();
+        st = this->fileStat;
+      }
+
       Log(Logger::Lvl4,hdfslogmask,hdfslogname, "File " << this->path.c_str() << " has size" <<  st.st_size);
       return st;
 
@@ -327,8 +917,15 @@ HdfsIODriver::HdfsIODriver(const std::string& nameNode,
                                const std::string& passwd,
                                bool useIp,
 			       const std::string& tmpFolder,
-			       unsigned replication):
-  nameNode(nameNode), port(port), uname(uname),tokenPasswd(passwd), tokenUseIp(useIp), tmpFolder(tmpFolder), replication(replication)
+			       unsigned replication,
+			       bool zeroCopy,
+			       bool zeroCopySkipChecksum,
+			       unsigned readBufferMin,
+			       unsigned readBufferMax,
+			       bool directWrite):
+  nameNode(nameNode), port(port), uname(uname),tokenPasswd(passwd), tokenUseIp(useIp), tmpFolder(tmpFolder), replication(replication),
+  zeroCopy(zeroCopy), zeroCopySkipChecksum(zeroCopySkipChecksum),
+  readBufferMin(readBufferMin), readBufferMax(readBufferMax), directWrite(directWrite)
 {
 //nothing
 }
@@ -383,7 +980,8 @@ IOHandler *HdfsIODriver::createIOHandler(const std::string& pfn,
                       this->userId.c_str());
     }		
   
-    return new HdfsIOHandler(this, pfn, flags);
+    // The client may know better how it is going to read
+    return new HdfsIOHandler(this, pfn, flags, extras.getUnsigned("hdfsBufferSize", 0));
 }
 
 
@@ -399,28 +997,26 @@ void HdfsIODriver::doneWriting(const Location& loc) throw (DmException)
   // Name the replica properly (supress .upload)
   std::string final = loc[0].url.path.substr(0, loc[0].url.path.length() - 7);
 
-  hdfsFS fs =  hdfsConnectAsUserNewInstance(this->nameNode.c_str(), this->port, this->uname.c_str());
+  HdfsConnection conn(this->nameNode, this->port, this->uname);
 
-  if (hdfsRename(fs, loc[0].url.path.c_str(), final.c_str()) != 0) {
+  // Computed by the handler at close, if it ran in this process
+  std::map<std::string, std::string> checksums;
+  if (HdfsChecksum::enabled())
+    HdfsChecksum::recall(loc[0].url.path, checksums);
 
-    hdfsDisconnect(fs);
+  if (!conn.check(hdfsRename(conn.get(), loc[0].url.path.c_str(), final.c_str()) == 0)) {
 
     throw DmException(errno, "Could not rename %s to %s",
                      loc[0].url.path.c_str(), final.c_str());
 
   }
 
-  //set status and size
-  try {
-   
-     this->updateReplica(fs, final);
-
-  } catch (DmException& e) { 
-	hdfsDisconnect(fs);
-	throw e;
-  }
+  // The checksums computed at the upload follow the file
+  if (HdfsChecksum::enabled())
+    HdfsChecksum::rename(conn.get(), loc[0].url.path, final);
 
-  hdfsDisconnect(fs);
+  //set status and size
+  this->updateReplica(conn.get(), final, checksums);
 
   Log(Logger::Lvl4,hdfslogmask,hdfslogname," renaming replica to " << final.c_str());
 
@@ -429,7 +1025,8 @@ void HdfsIODriver::doneWriting(const Location& loc) throw (DmException)
 
 
 
-void  HdfsIODriver::updateReplica(hdfsFS fs, std::string& final) throw (DmException) 
+void  HdfsIODriver::updateReplica(hdfsFS fs, std::string& final,
+                                  const std::map<std::string, std::string>& checksums) throw (DmException) 
 {
   
   //remove the host info if present
@@ -454,6 +1051,19 @@ void  HdfsIODriver::updateReplica(hdfsFS fs, std::string& final) throw (DmExcept
 
   this->si_->getCatalog()->setSize(uri_string.c_str(),hInfo->mSize);
 
+  // Known from the upload, the file does not need to be read back.
+  // The hdfs namespace serves them from the checksum file already.
+  if (!checksums.empty() && !dynamic_cast<HdfsNS*>(this->si_->getCatalog())) {
+    std::map<std::string, std::string>::const_iterator i;
+    for (i = checksums.begin(); i != checksums.end(); ++i) {
+      std::string legacy = HdfsChecksum::shortName(i->first);
+      if (!legacy.empty()) {
+        this->si_->getCatalog()->setChecksum(uri_string, legacy, i->second);
+        break;
+      }
+    }
+  }
+
   hdfsFreeFileInfo(hInfo, 1);
     
 }
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsLocality.cpp
+/// @brief   choice of the gateway closest to the blocks of a file.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <stdlib.h>
+#include <strings.h>
+
+using namespace dmlite;
+
+// Entries kept in the cache, it is cleared when full
+#define MAX_CACHED_PATHS 10000
+
+pthread_mutex_t HdfsLocality::mtx_ = PTHREAD_MUTEX_INITIALIZER;
+std::map<std::string, HdfsLocality::Entry> HdfsLocality::cache;
+unsigned HdfsLocality::ttl = 30;
+
+
+
+void HdfsLocality::setCacheTTL(unsigned seconds) throw ()
+{
+  HdfsLock l(&mtx_);
+  ttl = seconds;
+  cache.clear();
+}
+
+
+
+bool HdfsLocality::sameHost(const std::string& gatewaySpec, const std::string& host) throw ()
+{
+  // The gateways may be configured as host:port, or [address]:port
+  std::string gateway = gatewaySpec;
+  if (!gateway.empty() && gateway[0] == '[')
+    gateway = gateway.substr(1, gateway.find(']') - 1);
+  else if (gateway.find(':') == gateway.rfind(':'))
+    gateway = gateway.substr(0, gateway.find(':'));
+
+  if (strcasecmp(gateway.c_str(), host.c_str()) == 0)
+    return true;
+
+  // Short and fully qualified names of the same machine
+  size_t gatewayDot = gateway.find('.');
+  size_t hostDot    = host.find('.');
+  if ((gatewayDot == std::string::npos) == (hostDot == std::string::npos))
+    return false;
+
+  return strcasecmp(gateway.substr(0, gatewayDot).c_str(), host.substr(0, hostDot).c_str()) == 0;
+}
+
+
+
+bool HdfsLocality::getHosts(hdfsFS fs, const std::string& path, off_t size, Hosts& hosts) throw ()
+{
+  time_t now = time(NULL);
+
+  {
+    HdfsLock l(&mtx_);
+    std::map<std::string, Entry>::iterator i = cache.find(path);
+    if (i != cache.end()) {
+      if (i->second.expires > now) {
+        hosts = i->second.hosts;
+        return true;
+      }
+      cache.erase(i);
+    }
+  }
+
+  char*** blocks = hdfsGetHosts(fs, path.c_str(), 0, size);
+  if (!blocks)
+    return false;
+
+  for (int b = 0; blocks[b]; ++b) {
+    for (int h = 0; blocks[b][h]; ++h)
+      hosts[blocks[b][h]]++;
+  }
+  hdfsFreeHosts(blocks);
+
+  HdfsLock l(&mtx_);
+  if (ttl > 0) {
+    if (cache.size() >= MAX_CACHED_PATHS)
+      cache.clear();
+    Entry& entry  = cache[path];
+    entry.hosts   = hosts;
+    entry.expires = now + ttl;
+  }
+  return true;
+}
+
+
+
+std::string HdfsLocality::getGateway(hdfsFS fs, const std::string& path, off_t size,
+                                     const std::vector<std::string>& gateways) throw ()
+{
+  Hosts hosts;
+
+  // Nothing to choose from, or no block at all
+  if (gateways.size() < 2 || size <= 0 || !getHosts(fs, path, size, hosts))
+    return HDFSUtil::getRandomGateway(gateways);
+
+  std::vector<std::string> best;
+  unsigned bestReplicas = 0;
+
+  for (size_t g = 0; g < gateways.size(); ++g) {
+    unsigned replicas = 0;
+    for (Hosts::const_iterator h = hosts.begin(); h != hosts.end(); ++h) {
+      if (sameHost(gateways[g], h->first))
+        replicas += h->second;
+    }
+
+    if (replicas > bestReplicas) {
+      best.clear();
+      bestReplicas = replicas;
+    }
+    if (replicas == bestReplicas && replicas > 0)
+      best.push_back(gateways[g]);
+  }
+
+  if (best.empty())
+    return HDFSUtil::getRandomGateway(gateways);
+
+  Log(Logger::Lvl4, hdfslogmask, hdfslogname, "gateway for " << path << " holds " << bestReplicas << " block replicas");
+  return HDFSUtil::getRandomGateway(best);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsLocality.h
+/// @brief   choice of the gateway closest to the blocks of a file.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSLOCALITY_H
+#define HDFSLOCALITY_H
+
+#include <hdfs.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dmlite {
+
+/// Picks the gateway which is also the datanode of most of the block
+/// replicas of a file. The block hosts are cached for a few seconds per path,
+/// so that redirecting a client does not cost a namenode call every time.
+class HdfsLocality {
+public:
+	/// 0 disables the cache
+	static void setCacheTTL(unsigned seconds) throw ();
+
+	/// Falls back to a random gateway when none holds a block
+	static std::string getGateway(hdfsFS fs, const std::string& path, off_t size,
+			const std::vector<std::string>& gateways) throw ();
+
+private:
+	/// Number of block replicas per datanode
+	typedef std::map<std::string, unsigned> Hosts;
+
+	struct Entry {
+		Hosts  hosts;
+		time_t expires;
+	};
+
+	static bool getHosts(hdfsFS fs, const std::string& path, off_t size, Hosts& hosts) throw ();
+	/// The port of a host:port gateway is ignored
+	static bool sameHost(const std::string& gateway, const std::string& host) throw ();
+
+	static pthread_mutex_t mtx_;
+	static std::map<std::string, Entry> cache;
+	static unsigned ttl;
+};
+
+};
+
+#endif // HDFSLOCALITY_H
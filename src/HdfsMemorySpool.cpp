@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsMemorySpool.cpp
+/// @brief   in memory buffer of the small uploads.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace dmlite;
+
+// Small enough not to waste memory on the tiny uploads
+#define CHUNK_SIZE BUFF_SIZE
+
+uint64_t HdfsMemorySpool::maxSize = 0;
+uint64_t HdfsMemorySpool::budget  = 1024 * 1024 * 1024;
+
+
+
+void HdfsMemorySpool::setMaxSize(uint64_t bytes) throw ()
+{
+  maxSize = bytes;
+}
+
+
+
+void HdfsMemorySpool::setBudget(uint64_t bytes) throw ()
+{
+  budget = bytes;
+}
+
+
+
+bool HdfsMemorySpool::enabled(void) throw ()
+{
+  return maxSize > 0 && budget > 0;
+}
+
+
+
+HdfsMemorySpool::HdfsMemorySpool(): length(0), allocated(0)
+{
+}
+
+
+
+HdfsMemorySpool::~HdfsMemorySpool()
+{
+  for (size_t i = 0; i < this->chunks.size(); ++i)
+    delete [] this->chunks[i];
+  HdfsIOStats::spoolMemory.sub(this->allocated);
+}
+
+
+
+bool HdfsMemorySpool::write(const char* buffer, size_t count, off_t offset) throw ()
+{
+  if (count == 0)
+    return true;
+  if (offset < 0 || (uint64_t)offset + count > maxSize)
+    return false;
+
+  size_t first = offset / CHUNK_SIZE;
+  size_t last  = (offset + count - 1) / CHUNK_SIZE;
+  if (last >= this->chunks.size())
+    this->chunks.resize(last + 1, 0);
+
+  // Reserve the new chunks against the budget of the process
+  uint64_t needed = 0;
+  for (size_t i = first; i <= last; ++i) {
+    if (!this->chunks[i])
+      needed += CHUNK_SIZE;
+  }
+  if (needed) {
+    HdfsIOStats::spoolMemory.add(needed);
+    if (HdfsIOStats::spoolMemory.get() > budget) {
+      HdfsIOStats::spoolMemory.sub(needed);
+      return false;
+    }
+    this->allocated += needed;
+  }
+
+  size_t done = 0;
+  for (size_t i = first; i <= last; ++i) {
+    if (!this->chunks[i]) {
+      this->chunks[i] = new char[CHUNK_SIZE];
+      memset(this->chunks[i], 0, CHUNK_SIZE);
+    }
+    size_t within = (offset + done) % CHUNK_SIZE;
+    size_t n      = std::min((size_t)CHUNK_SIZE - within, count - done);
+    memcpy(this->chunks[i] + within, buffer + done, n);
+    done += n;
+  }
+
+  this->length = std::max(this->length, (off_t)(offset + count));
+  return true;
+}
+
+
+
+bool HdfsMemorySpool::writeTo(int fd) throw ()
+{
+  for (size_t i = 0; i < this->chunks.size(); ++i) {
+    if (!this->chunks[i])
+      continue;
+
+    off_t  offset = (off_t)i * CHUNK_SIZE;
+    size_t size   = std::min((off_t)CHUNK_SIZE, this->length - offset);
+    size_t done   = 0;
+    while (done < size) {
+      ssize_t n = ::pwrite(fd, this->chunks[i] + done, size - done, offset + done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return false;
+      done += n;
+    }
+  }
+
+  // The trailing hole
+  return ::ftruncate(fd, this->length) == 0;
+}
+
+
+
+bool HdfsMemorySpool::writeTo(hdfsFS fs, hdfsFile file, HdfsChecksum* checksum) throw ()
+{
+  static const char zeros[CHUNK_SIZE] = {0};
+
+  for (size_t i = 0; i < this->chunks.size(); ++i) {
+    off_t       offset = (off_t)i * CHUNK_SIZE;
+    size_t      size   = std::min((off_t)CHUNK_SIZE, this->length - offset);
+    const char* data   = this->chunks[i] ? this->chunks[i] : zeros;
+    size_t      done   = 0;
+    if (checksum)
+      checksum->update(data, size);
+    while (done < size) {
+      tSize n = hdfsWrite(fs, file, data + done, size - done);
+      if (n < 0)
+        return false;
+      done += n;
+    }
+  }
+  return true;
+}
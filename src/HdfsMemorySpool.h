@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsMemorySpool.h
+/// @brief   in memory buffer of the small uploads.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSMEMORYSPOOL_H
+#define HDFSMEMORYSPOOL_H
+
+#include <hdfs.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+#include "HdfsChecksum.h"
+
+namespace dmlite {
+
+/// Holds an upload in fixed size chunks until it is written to hdfs, in place
+/// of the temp file. The writes which would take the upload over the size
+/// limit, or the spools of the process over the memory budget, are refused:
+/// the upload is then spilled to the temp file.
+class HdfsMemorySpool {
+public:
+	/// Largest upload held in memory, 0 disables the memory spools
+	static void setMaxSize(uint64_t bytes) throw ();
+	/// Memory used by all the spools of the process
+	static void setBudget(uint64_t bytes) throw ();
+
+	static bool enabled(void) throw ();
+
+	HdfsMemorySpool();
+	~HdfsMemorySpool();
+
+	/// Returns false, writing nothing, if the limits would be exceeded
+	bool  write(const char* buffer, size_t count, off_t offset) throw ();
+	off_t size(void) const { return length; }
+
+	/// Copy the content, with the holes zeroed. Return false on error, with errno set
+	bool  writeTo(int fd) throw ();
+	bool  writeTo(hdfsFS fs, hdfsFile file, HdfsChecksum* checksum = 0) throw ();
+
+private:
+	std::vector<char*> chunks; // 0 for the holes
+	off_t    length;
+	uint64_t allocated;
+
+	static uint64_t maxSize;
+	static uint64_t budget;
+};
+
+};
+
+#endif // HDFSMEMORYSPOOL_H
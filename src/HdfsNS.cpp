@@ -14,10 +14,11 @@ using namespace dmlite;
 
 // HdfsNSFactory implementation
 HdfsNSFactory::HdfsNSFactory() throw (DmException):
-      nameNode("localhost"), port(8020), uname("dpmmgr"),mode("rw")
+      nameNode("localhost"), port(8020), uname("dpmmgr"),mode("rw"),
+      warmUpConnections(1), backend(0)
 
 {
-  // Nothing
+  pthread_mutex_init(&this->mtx_, 0);
 }
 
   
@@ -44,6 +45,42 @@ void HdfsNSFactory::configure(const std::string& key, const std::string& value)
   else if (key == "HdfsUser") {
     this->uname = value;
   }
+  else if (key == "HdfsConnectionPoolSize") {
+    HdfsConnectionPool::instance()->setMaxIdle((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsConnectionIdleTimeout") {
+    HdfsConnectionPool::instance()->setIdleTimeout((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsConnectionValidateInterval") {
+    HdfsConnectionPool::instance()->setValidateInterval((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsMaxConcurrentOps") {
+    HdfsAdmission::setMaxConcurrent((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsAdmissionTimeout") {
+    HdfsAdmission::setTimeout((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsBlockLocationCacheTTL") {
+    HdfsLocality::setCacheTTL((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsChecksumTypes") {
+    HdfsChecksum::setTypes(value);
+  }
+  else if (key == "HdfsChecksumDir") {
+    HdfsChecksum::setDirectory(value);
+  }
+  else if (key == "HdfsConnectTimeout") {
+    HdfsConnectionPool::instance()->setConnectTimeout((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsConnectThreads") {
+    HdfsConnectionPool::instance()->setConnectThreads((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsNameNodeProbeInterval") {
+    HdfsNameNodes::setProbeInterval((unsigned)atoi(value.c_str()));
+  }
+  else if (key == "HdfsWarmUpConnections") {
+    this->warmUpConnections = (unsigned)atoi(value.c_str());
+  }
   else if (key == "HdfsMode") {
       this->mode = value;
     }
@@ -94,12 +131,21 @@ void HdfsNSFactory::configure(const std::string& key, const std::string& value)
 
 Catalog* HdfsNSFactory::createCatalog(PluginManager* pm) throw(DmException)
 {
-
-         return new HdfsNS(this->nameNode,
-                         this->port,
-                         this->uname,
-                         this->mode,
-			 this->gateways);
+         // The configuration is complete by now, warm up in the background
+         HdfsConnectionPool::instance()->warmUp(this->nameNode, this->port, this->uname,
+                                                this->warmUpConnections);
+
+         // Shared by all the catalogs, which only keep their own cwd and security context
+         {
+           HdfsLock l(&this->mtx_);
+           if (!this->backend)
+             this->backend = new HdfsNSBackend(this->nameNode,
+                                               this->port,
+                                               this->uname,
+                                               this->gateways);
+         }
+
+         return new HdfsNS(this->backend);
 }
 
 
@@ -124,36 +170,72 @@ Authn* HdfsNSFactory::createAuthn(PluginManager*) throw (DmException)
 
 HdfsNSFactory::~HdfsNSFactory() throw (DmException)
 {
+  delete this->backend;
+  pthread_mutex_destroy(&this->mtx_);
+}
 
+
+
+HdfsNSBackend::HdfsNSBackend(const std::string& nameNode,
+                unsigned port,
+                const std::string& uname,
+                const std::vector<std::string>& gateways):
+  nameNode(nameNode), port(port), uname(uname), gateways(gateways)
+{
+  pthread_mutex_init(&this->mtx_, 0);
+  Log(Logger::Lvl4,hdfslogmask, hdfslogname, "gateway size: " << this->gateways.size());
 }
 
 
-HdfsNS::HdfsNS(std::string nameNode,
-		unsigned port,
-		std::string uname,
-		std::string mode,
-		const std::vector<std::string>& gateways)
 
- throw (DmException): nameNode(nameNode),
- port(port),uname(uname),mode(mode),cwd("")
+HdfsNSBackend::~HdfsNSBackend()
 {
-	fs = hdfsConnectAsUser(nameNode.c_str(),
-            port,
-            uname.c_str());
+  pthread_mutex_destroy(&this->mtx_);
+}
+
 
-	if (fs == 0)
-		throw DmException(DMLITE_SYSERR(errno),
-				"Could not create a HdfsNS: cannot connect to Hdfs");
 
-	this->cwd = getWorkingDir();
-	this->gateways = std::vector<std::string>(gateways);
-	Log(Logger::Lvl4,hdfslogmask, hdfslogname, "gateway size: " << this->gateways.size());
+std::string HdfsNSBackend::getHomeDir(void) throw (DmException)
+{
+  HdfsLock l(&this->mtx_);
+
+  if (this->homeDir.empty()) {
+    char buffer[PATH_MAX];
+    HdfsConnection conn(this->nameNode, this->port, this->uname);
+
+    if (!conn.check(hdfsGetWorkingDirectory(conn.get(), buffer, sizeof(buffer)) != NULL))
+      throw DmException(DMLITE_SYSERR(errno), "Could not get Current Working dir");
+
+    this->homeDir = std::string(buffer);
+  }
+
+  return this->homeDir;
+}
+
+
+HdfsNS::HdfsNS(HdfsNSBackend* backend) throw (DmException):
+ backend(backend), cwd("")
+{
+	// Nothing, the connections are leased from the backend on each call
 }
 
 
 HdfsNS::~HdfsNS() throw (DmException)
 {
-	 hdfsDisconnect(this->fs);
+	// Nothing
+}
+
+std::string HdfsNS::absolutePath(const std::string& path) throw (DmException)
+{
+	if (!path.empty() && path[0] == '/')
+		return path;
+
+	std::string dir = this->getWorkingDir();
+	if (path.empty())
+		return dir;
+	if (dir.empty() || dir[dir.length() - 1] != '/')
+		dir.append("/");
+	return dir.append(path);
 }
 
 //poolmanager methods
@@ -167,37 +249,46 @@ std::string HdfsNS::getImplId() const throw ()
 
 void HdfsNS::changeDir(const std::string& path) throw (DmException)
 {
-
-	if (hdfsSetWorkingDirectory(this->fs,path.c_str())!= 0)
-		 throw DmException(DMLITE_SYSERR(errno), "Could not changeDir to %s",
-		                       path.c_str());
-	this->cwd = path;
-
+	// The working dir is kept per stack, the backend connections are shared
+	this->cwd = this->absolutePath(path);
 }
 
 std::string HdfsNS::getWorkingDir(void) throw (DmException)
 {
-	
-        char buffer[PATH_MAX]; 
-
-	hdfsGetWorkingDirectory(this->fs,buffer,sizeof(buffer));
-
-	if ( buffer == NULL)
-	 throw DmException(DMLITE_SYSERR(errno), "Could not get Current Working dir");
-
-	this->cwd = std::string(buffer);
+	if (this->cwd.empty())
+		this->cwd = this->backend->getHomeDir();
 
 	return this->cwd;
-	
 }
 
-ExtendedStat HdfsNS::extendedStat(const std::string& path,
+// Stored at the upload or by setChecksum
+static void getChecksums(hdfsFS fs, const std::string& path, tOffset size, ExtendedStat& exStat)
+{
+	std::map<std::string, std::string> values;
+	if (!HdfsChecksum::enabled() || !HdfsChecksum::load(fs, path, size, values))
+		return;
+
+	std::map<std::string, std::string>::const_iterator i;
+	for (i = values.begin(); i != values.end(); ++i) {
+		exStat["checksum." + i->first] = i->second;
+		std::string legacy = HdfsChecksum::shortName(i->first);
+		if (exStat.csumtype.empty() && !legacy.empty()) {
+			exStat.csumtype  = legacy;
+			exStat.csumvalue = i->second;
+		}
+	}
+}
+
+ExtendedStat HdfsNS::extendedStat(const std::string& relPath,
 			bool followSym) throw (DmException)
 {
-	hdfsFileInfo* hInfo = hdfsGetPathInfo(this->fs, path.c_str());
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
+	hdfsFileInfo* hInfo = hdfsGetPathInfo(conn.get(), path.c_str());
 
 
-	if (!hInfo)
+	if (!conn.check(hInfo != 0))
 		throw DmException(ENOENT, "HDFSNS: Cannot stat %s",path.c_str());
 
 	ExtendedStat exStat;
@@ -212,7 +303,7 @@ ExtendedStat HdfsNS::extendedStat(const std::string& path,
  	
 	if (hInfo->mKind == kObjectKindDirectory) {
 		 int numFiles;
-		 hdfsFileInfo* hFolder = hdfsListDirectory(this->fs, path.c_str(),&numFiles);
+		 hdfsFileInfo* hFolder = hdfsListDirectory(conn.get(), path.c_str(),&numFiles);
 		 exStat.stat.st_nlink = numFiles;
 		 hdfsFreeFileInfo(hFolder, numFiles);
 	} else  
@@ -234,6 +325,9 @@ ExtendedStat HdfsNS::extendedStat(const std::string& path,
  	std::vector<std::string> components = Url::splitPath(path);
 	exStat.name = components.back();
 
+	if (hInfo->mKind == kObjectKindFile)
+		getChecksums(conn.get(), path, hInfo->mSize, exStat);
+
 	hdfsFreeFileInfo(hInfo, 1);
 
 	return exStat;
@@ -243,6 +337,8 @@ ExtendedStat HdfsNS::extendedStat(const std::string& path,
 
 ExtendedStat HdfsNS::extendedStatByRFN(const std::string& rfn) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+
 
   //remove the host info if present
   std::string uri_string = std::string(rfn);
@@ -253,9 +349,9 @@ ExtendedStat HdfsNS::extendedStatByRFN(const std::string& rfn) throw (DmExceptio
           uri_string = uri_string.substr(index+1, rfn.size());
   }
 
-   hdfsFileInfo* hInfo = hdfsGetPathInfo(this->fs, uri_string.c_str());
+   hdfsFileInfo* hInfo = hdfsGetPathInfo(conn.get(), uri_string.c_str());
 
-   if (!hInfo)
+   if (!conn.check(hInfo != 0))
         throw DmException(ENOENT, "HDFSNS: Cannot stat %s",uri_string.c_str());
 
    ExtendedStat exStat;
@@ -270,7 +366,7 @@ ExtendedStat HdfsNS::extendedStatByRFN(const std::string& rfn) throw (DmExceptio
   
    if (hInfo->mKind == kObjectKindDirectory) {
            int numFiles;
-           hdfsFileInfo* hFolder = hdfsListDirectory(this->fs, rfn.c_str(),&numFiles);
+           hdfsFileInfo* hFolder = hdfsListDirectory(conn.get(), rfn.c_str(),&numFiles);
            exStat.stat.st_nlink = numFiles;
            hdfsFreeFileInfo(hFolder, numFiles);
      } else  
@@ -288,33 +384,45 @@ ExtendedStat HdfsNS::extendedStatByRFN(const std::string& rfn) throw (DmExceptio
    std::vector<std::string> components = Url::splitPath(uri_string);
    exStat.name = components.back();
 
+   if (hInfo->mKind == kObjectKindFile)
+           getChecksums(conn.get(), uri_string, hInfo->mSize, exStat);
+
    hdfsFreeFileInfo(hInfo, 1);
 
    return exStat;
 
 }
 
-void HdfsNS::unlink(const std::string& path) throw (DmException)
+void HdfsNS::unlink(const std::string& relPath) throw (DmException)
 {
-	if (hdfsDelete(this->fs,path.c_str(),1)!= 0)
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
+	if (!conn.check(hdfsDelete(conn.get(),path.c_str(),1) == 0))
 			 throw DmException(DMLITE_SYSERR(errno), "Could not unlink path %s",
 			                       path.c_str());
+
+	if (HdfsChecksum::enabled())
+		HdfsChecksum::remove(conn.get(), path);
 }
 
-void HdfsNS::create(const std::string& path,mode_t mode) throw (DmException)
+void HdfsNS::create(const std::string& relPath,mode_t mode) throw (DmException)
 {
-	int ret = hdfsExists(this->fs, path.c_str());
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
+	int ret = hdfsExists(conn.get(), path.c_str());
 
 
-	if(ret==0)
+	if(conn.check(ret==0))
 		throw DmException(DMLITE_SYSERR(errno),"Path %s already exists on HDFS",path.c_str());
 	else {
-		hdfsFile file =  hdfsOpenFile(this->fs, path.c_str(), mode, 0, 0, 0);
+		hdfsFile file =  hdfsOpenFile(conn.get(), path.c_str(), mode, 0, 0, 0);
 		 
-		if (file)
+		if (conn.check(file != 0))
 		    {
-			hdfsWrite(this->fs, file, 0, 0);
-    			hdfsCloseFile(this->fs, file);
+			hdfsWrite(conn.get(), file, 0, 0);
+    			hdfsCloseFile(conn.get(), file);
 		    }
 
 		else  throw DmException(DMLITE_SYSERR(errno),"Could not create path %s",path.c_str());
@@ -323,24 +431,40 @@ void HdfsNS::create(const std::string& path,mode_t mode) throw (DmException)
 
 }
 
-void HdfsNS::makeDir(const std::string& path, mode_t mode) throw (DmException)
+void HdfsNS::makeDir(const std::string& relPath, mode_t mode) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
 	//mode is ignored
-	if(hdfsCreateDirectory(this->fs, path.c_str())!=0)
+	if(!conn.check(hdfsCreateDirectory(conn.get(), path.c_str())==0))
 		throw DmException(DMLITE_SYSERR(errno),"Could not create directory %s ",path.c_str());
 }
 
 
-void HdfsNS::rename(const std::string& oldPath, const std::string& newPath) throw (DmException)
+void HdfsNS::rename(const std::string& relOldPath, const std::string& relNewPath) throw (DmException)
 {
-	if(hdfsRename(this->fs, oldPath.c_str(),newPath.c_str())!=0)
+	HdfsNSConnection conn(this->backend);
+	std::string oldPath = this->absolutePath(relOldPath);
+	std::string newPath = this->absolutePath(relNewPath);
+
+	if(!conn.check(hdfsRename(conn.get(), oldPath.c_str(),newPath.c_str())==0))
 		throw DmException(DMLITE_SYSERR(errno),"Could not  rename  %s to %s",oldPath.c_str(),newPath.c_str());
+
+	if (HdfsChecksum::enabled())
+		HdfsChecksum::rename(conn.get(), oldPath, newPath);
 }
 
-void HdfsNS::removeDir(const std::string& path) throw (DmException)
+void HdfsNS::removeDir(const std::string& relPath) throw (DmException)
 {
-	if (hdfsDelete(this->fs,path.c_str(),1)!= 0)
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
+	if (!conn.check(hdfsDelete(conn.get(),path.c_str(),1) == 0))
 				 throw DmException(DMLITE_SYSERR(errno), "Could not delete dir %s",path.c_str());
+
+	if (HdfsChecksum::enabled())
+		HdfsChecksum::remove(conn.get(), path);
 }
 
 
@@ -380,19 +504,22 @@ void HdfsNS::updateReplica(const Replica& replica) throw (DmException)
 
 /// Get replicas for a file.
 /// @param path The file for which replicas will be retrieved.
-std::vector<Replica> HdfsNS::getReplicas(const std::string& path) throw (DmException)
+std::vector<Replica> HdfsNS::getReplicas(const std::string& relPath) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
 
-  if(hdfsExists(this->fs, path.c_str()) != 0){
+  if(!conn.check(hdfsExists(conn.get(), path.c_str()) == 0)){
     throw DmException(DMLITE_NO_REPLICAS, "HdfsNS: No replicas found on Hdfs for %s",
                       path.c_str());
   }
 
     std::vector<Replica> replicas;
 
-    for (unsigned i = 0; i < this->gateways.size(); ++i) {
+    for (unsigned i = 0; i < this->backend->gateways.size(); ++i) {
 
-        Log(Logger::Lvl4,hdfslogmask, hdfslogname, "gateway: " << this->gateways.at(i).c_str());
+        Log(Logger::Lvl4,hdfslogmask, hdfslogname, "gateway: " << this->backend->gateways.at(i).c_str());
     
     	Replica      replica;
   	ExtendedStat xStat = this->extendedStat(path, true);
@@ -405,7 +532,7 @@ std::vector<Replica> HdfsNS::getReplicas(const std::string& path) throw (DmExcep
   	replica.ltime      = 0;
   	replica.type       = Replica::kPermanent;
   	replica.status     = Replica::kAvailable;
-  	replica.server     = this->gateways.at(i).c_str();
+  	replica.server     = this->backend->gateways.at(i).c_str();
   	replica["pool"]    = std::string("hdfs_pool");
 	replica.rfn 	   = path;
 
@@ -431,10 +558,13 @@ return 0;
 /// Set the mode of a file.
 /// @param path The file to modify.
 /// @param mode The new mode as an integer (i.e. 0755)
-void  HdfsNS::setMode(const std::string& path,mode_t mode) throw (DmException)
-{ 
+void  HdfsNS::setMode(const std::string& relPath,mode_t mode) throw (DmException)
+{
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+ 
      //mode is ignored
-     if(hdfsChmod(this->fs, path.c_str(),mode)!=0)
+     if(!conn.check(hdfsChmod(conn.get(), path.c_str(),mode)==0))
                 throw DmException(DMLITE_SYSERR(errno),"Could not set mode %s , %d",path.c_str(),mode);
 
 }
@@ -444,8 +574,11 @@ void  HdfsNS::setMode(const std::string& path,mode_t mode) throw (DmException)
 /// @param newUid The uid of the new owneer.
 // @param newGid The gid of the new group.
 /// @param followSymLink If set to true, symbolic links will be followed.
-void  HdfsNS::setOwner(const std::string& path, uid_t newUid, gid_t newGid, bool followSymLink) throw (DmException)
+void  HdfsNS::setOwner(const std::string& relPath, uid_t newUid, gid_t newGid, bool followSymLink) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
 
    struct passwd * userInfo ;
    struct group * groupInfo ;
@@ -455,7 +588,7 @@ void  HdfsNS::setOwner(const std::string& path, uid_t newUid, gid_t newGid, bool
    groupInfo = (struct group * )wrapCall(getgrgid(newGid));
 
 
-   if(hdfsChown(this->fs, path.c_str(),userInfo->pw_name,groupInfo->gr_name)!=0)
+   if(!conn.check(hdfsChown(conn.get(), path.c_str(),userInfo->pw_name,groupInfo->gr_name)==0))
                 throw DmException(DMLITE_SYSERR(errno),"Could not set Owner %s , %d,%d",path.c_str(),newUid,newGid);
 
 }
@@ -465,19 +598,44 @@ void HdfsNS::setSize(const std::string& path, size_t newSize) throw (DmException
 //not avaialble for hdfs
 }
 
-void HdfsNS::setChecksum(const std::string& path, const std::string& csumtype, const std::string& csumvalue) throw (DmException)
+void HdfsNS::setChecksum(const std::string& relPath, const std::string& csumtype, const std::string& csumvalue) throw (DmException)
 {
-//not avaialble for hdfs
+	// Stored in the checksum directory, hdfs has no place for them
+	if (!HdfsChecksum::enabled())
+		return;
+
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
+	hdfsFileInfo* hInfo = hdfsGetPathInfo(conn.get(), path.c_str());
+	if (!conn.check(hInfo != 0))
+		throw DmException(ENOENT, "HDFSNS: Cannot stat %s",path.c_str());
+	tOffset size = hInfo->mSize;
+	hdfsFreeFileInfo(hInfo, 1);
+
+	std::map<std::string, std::string> values;
+	HdfsChecksum::load(conn.get(), path, size, values);
+
+	std::string name = HdfsChecksum::fullName(csumtype);
+	std::map<std::string, std::string>::iterator i = values.find(name);
+	if (i != values.end() && i->second == csumvalue)
+		return;
+
+	values[name] = csumvalue;
+	HdfsChecksum::store(conn.get(), path, size, values);
 }
 
 /// Set access and/or modification time.
 /// @param path The file path.
 /// @param buf  A struct holding the new times.
-void  HdfsNS::utime(const std::string& path, const struct utimbuf* buf) throw (DmException)
+void  HdfsNS::utime(const std::string& relPath, const struct utimbuf* buf) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
 
 
-  if (hdfsUtime(this->fs, path.c_str(), buf->modtime, buf->actime)!=0)
+
+  if (!conn.check(hdfsUtime(conn.get(), path.c_str(), buf->modtime, buf->actime)==0))
 	 throw DmException(DMLITE_SYSERR(errno),"Could not acc/mod time %s , %d,%d",path.c_str(),buf->modtime, buf->actime);
 
 
@@ -488,8 +646,11 @@ void  HdfsNS::utime(const std::string& path, const struct utimbuf* buf) throw (D
 /// Open a directory for reading.
 /// @param path The directory to open.
 /// @return     A pointer to a handle that can be used for later calls.
-Directory*  HdfsNS::openDir(const std::string& path) throw (DmException)
+Directory*  HdfsNS::openDir(const std::string& relPath) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+	std::string path = this->absolutePath(relPath);
+
  	HDFSDir *dir;
 	ExtendedStat stat;
 	int numEntries = 0;
@@ -502,7 +663,8 @@ Directory*  HdfsNS::openDir(const std::string& path) throw (DmException)
         dir->path = path;
 
 
-	hdfsFileInfo* fileInfos = hdfsListDirectory(this->fs, dir->path.c_str(), &numEntries);
+	hdfsFileInfo* fileInfos = hdfsListDirectory(conn.get(), dir->path.c_str(), &numEntries);
+	conn.check(fileInfos != 0 || numEntries == 0);
 
 	
         dir->stat = stat;
@@ -531,6 +693,8 @@ void  HdfsNS::closeDir(Directory* dir) throw (DmException)
 /// @return    0x00 on failure or end of directory.
 struct dirent* HdfsNS::readDir(Directory* dir) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+
 
 	int numEntries = 0;
   	HDFSDir* _dir = dynamic_cast<HDFSDir*>(dir);
@@ -539,7 +703,8 @@ struct dirent* HdfsNS::readDir(Directory* dir) throw (DmException)
                 return 0x00;
 
 
-	hdfsFileInfo* fileInfos = hdfsListDirectory(this->fs, _dir->path.c_str(), &numEntries);
+	hdfsFileInfo* fileInfos = hdfsListDirectory(conn.get(), _dir->path.c_str(), &numEntries);
+	conn.check(fileInfos != 0);
 
 	//TO DO update access time
 	struct dirent* d;
@@ -561,6 +726,8 @@ struct dirent* HdfsNS::readDir(Directory* dir) throw (DmException)
 /// @return    0x00 on failure (and errno is set) or end of directory.
 ExtendedStat*  HdfsNS::readDirx(Directory* dir) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+
 	int numEntries = 0;
 
 	ExtendedStat * stat;
@@ -573,7 +740,8 @@ ExtendedStat*  HdfsNS::readDirx(Directory* dir) throw (DmException)
 	if (_dir->offset == _dir->length)
 		return 0x00;
 
-	hdfsFileInfo* fileInfos = hdfsListDirectory(this->fs, _dir->path.c_str(), &numEntries);
+	hdfsFileInfo* fileInfos = hdfsListDirectory(conn.get(), _dir->path.c_str(), &numEntries);
+	conn.check(fileInfos != 0);
 
 	//TO DO update access time
 
@@ -610,8 +778,10 @@ ExtendedStat*  HdfsNS::readDirx(Directory* dir) throw (DmException)
 /// @param rfn The replica file name.
 Replica  HdfsNS::getReplicaByRFN(const std::string& rfn) throw (DmException)
 {
+	HdfsNSConnection conn(this->backend);
+
 
-  if(hdfsExists(this->fs, rfn.c_str()) != 0){
+  if(!conn.check(hdfsExists(conn.get(), rfn.c_str()) == 0)){
     throw DmException(DMLITE_NO_REPLICAS, "No replicas found on Hdfs for %s",
                       rfn.c_str());
   }
@@ -627,7 +797,7 @@ Replica  HdfsNS::getReplicaByRFN(const std::string& rfn) throw (DmException)
         replica.ltime      = 0;
         replica.type       = Replica::kPermanent;
         replica.status     = Replica::kAvailable;
-        replica.server     = HDFSUtil::getRandomGateway(this->gateways).c_str();//random
+        replica.server     = HdfsLocality::getGateway(conn.get(), rfn, xStat.stat.st_size, this->backend->gateways);
         replica["pool"]    = std::string("hdfs_pool");
         replica.rfn        = rfn;
 
@@ -724,18 +894,26 @@ Location HdfsPoolManager::whereToRead(std::vector<Replica> replicas ) throw (DmE
     if (this->canRead()) {
 
 	std::vector<Location> available;
+	PoolHandler* handler = 0;
+	bool owned = false;
 
-	for (i = 0; i < replicas.size(); ++i) {
+	try {
+	  handler = this->getPoolHandler(&owned);
+	}
+	catch (DmException& e) {
+	  if (e.code() != DMLITE_NO_SUCH_POOL) throw;
+	}
 
- 	     try {
-	      PoolHandler* handler = this->si->getPoolDriver("hdfs")->createPoolHandler("hdfs_pool");
-	      available.push_back(handler->whereToRead(replicas[i]));
-	        delete handler;
-	      }
-	      catch (DmException& e) {
-	        if (e.code() != DMLITE_NO_SUCH_POOL) throw;
-	      }
-	  }
+	try {
+	  for (i = 0; handler && i < replicas.size(); ++i)
+	    available.push_back(handler->whereToRead(replicas[i]));
+	}
+	catch (...) {
+	  if (owned) delete handler;
+	  throw;
+	}
+
+	if (owned) delete handler;
 	  //  random one from the available
 	  if (available.size() > 0) {
 	    i = rand() % available.size();
@@ -780,11 +958,19 @@ Location HdfsPoolManager::whereToWrite(const std::string& path) throw (DmExcepti
 	 throw DmException(DMLITE_SYSERR(ENOSYS), "HdfsPoolManager: the file already exists");
 
 	
-	PoolHandler* handler = this->si->getPoolDriver("hdfs")->createPoolHandler("hdfs_pool");
+	bool owned;
+	PoolHandler* handler = this->getPoolHandler(&owned);
+	Location loc;
 
-	Location loc = handler->whereToWrite(path);
+	try {
+	  loc = handler->whereToWrite(path);
+	}
+	catch (...) {
+	  if (owned) delete handler;
+	  throw;
+	}
 
-	delete handler;
+	if (owned) delete handler;
 
     	return loc;
   
@@ -795,6 +981,20 @@ Location HdfsPoolManager::whereToWrite(const std::string& path) throw (DmExcepti
 }
 
 
+/// The hdfs driver caches its handlers, other drivers give us a new one
+/// which has to be deleted by the caller (owned is set to true).
+PoolHandler* HdfsPoolManager::getPoolHandler(bool* owned) throw (DmException)
+{
+	PoolDriver*     driver     = this->si->getPoolDriver("hdfs");
+	HdfsPoolDriver* hdfsDriver = dynamic_cast<HdfsPoolDriver*>(driver);
+
+	*owned = (hdfsDriver == 0);
+	if (hdfsDriver)
+		return hdfsDriver->getPoolHandler("hdfs_pool");
+	return driver->createPoolHandler("hdfs_pool");
+}
+
+
 bool HdfsPoolManager::canWrite(){
 	
 	return (this->mode == "w" || this->mode == "rw" || this->mode == "wr");
@@ -40,13 +40,43 @@
 namespace dmlite {
 
 
-class HdfsNS: public  Catalog {
+/// Namespace backend shared by all the HdfsNS instances of a factory.
+/// It holds the connection settings; connections are leased from the
+/// process-wide pool for each call, so it is safe to use from any thread.
+class HdfsNSBackend {
 public:
-	HdfsNS(	std::string nameNode,
+	HdfsNSBackend(const std::string& nameNode,
 			unsigned port,
-			std::string uname,
-			std::string mode,
-			const std::vector<std::string>&) throw (DmException);
+			const std::string& uname,
+			const std::vector<std::string>& gateways);
+	~HdfsNSBackend();
+
+	/// Working directory of a new connection, retrieved only once
+	std::string getHomeDir(void) throw (DmException);
+
+	const std::string nameNode;
+	const unsigned    port;
+	const std::string uname;
+	const std::vector<std::string> gateways;
+
+private:
+	pthread_mutex_t mtx_;
+	std::string homeDir;
+};
+
+/// Lease of a backend connection for the duration of a call, once admitted
+/// (the bases are built in order, so the ticket is taken first)
+class HdfsNSConnection: private HdfsAdmissionTicket, public HdfsConnection {
+public:
+	HdfsNSConnection(HdfsNSBackend* backend) throw (DmException):
+		HdfsAdmissionTicket(backend->nameNode),
+		HdfsConnection(backend->nameNode, backend->port, backend->uname) {}
+};
+
+
+class HdfsNS: public  Catalog {
+public:
+	HdfsNS(HdfsNSBackend* backend) throw (DmException);
 
 	~HdfsNS() throw (DmException);
 
@@ -108,20 +138,17 @@ public:
 	Replica getReplicaByRFN(const std::string& rfn) throw (DmException);
 
 private:
+	/// Resolves a path relative to the working dir
+	std::string absolutePath(const std::string& path) throw (DmException);
+
 	StackInstance* si;
 
+	HdfsNSBackend* backend;
+
   	std::string cwd;
 
 	const SecurityContext* secCtx;
 
-
-	hdfsFS fs;
-	std::string nameNode;
-	unsigned    port;
-	std::string uname;
-	std::string mode;
-        std::vector<std::string> gateways;
-
 };
 
 class HdfsPoolManager :public PoolManager {
@@ -164,6 +191,8 @@ private:
 	bool canWrite();
 	bool canRead();
 
+	PoolHandler* getPoolHandler(bool* owned) throw (DmException);
+
 	StackInstance* si;
 	
 
@@ -191,7 +220,6 @@ public:
         Authn* createAuthn(PluginManager* pm) throw (DmException);
 
 private:
-	hdfsFS fs;
 	std::string nameNode;
 	unsigned    port;
 	std::string uname;
@@ -202,6 +230,10 @@ private:
         unsigned    tokenLife;
 	std::string mapFile;
 	std::vector<std::string> gateways;
+	unsigned    warmUpConnections;
+
+	pthread_mutex_t mtx_;
+	HdfsNSBackend* backend;
 };
 
 class HDFSDir: public Directory {
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsNameNodes.cpp
+/// @brief   selection of the active namenode of a HA cluster.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace dmlite;
+
+unsigned HdfsNameNodes::probeInterval = 10;
+
+static pthread_mutex_t registryMtx = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, HdfsNameNodes*> registry;
+
+
+
+HdfsNameNodes* HdfsNameNodes::get(const std::string& nameNodes, unsigned port,
+                                  const std::string& user) throw ()
+{
+  if (nameNodes.find(',') == std::string::npos)
+    return 0;
+
+  std::stringstream key;
+  key << nameNodes << "|" << port << "|" << user;
+
+  HdfsLock l(&registryMtx);
+
+  std::map<std::string, HdfsNameNodes*>::iterator i = registry.find(key.str());
+  if (i != registry.end())
+    return i->second;
+
+  // Never freed, the probe thread runs until the process exits
+  HdfsNameNodes* selector = new HdfsNameNodes(nameNodes, port, user);
+  if (selector->candidates.empty()) {
+    delete selector;
+    return 0;
+  }
+  registry[key.str()] = selector;
+
+  pthread_t      thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int err = pthread_create(&thread, &attr, run, selector);
+  pthread_attr_destroy(&attr);
+
+  if (err)
+    Err(hdfslogname, "could not start the namenode probe thread: " << strerror(err));
+
+  return selector;
+}
+
+
+
+void HdfsNameNodes::setProbeInterval(unsigned seconds) throw ()
+{
+  probeInterval = seconds > 0 ? seconds : 1;
+}
+
+
+
+HdfsNameNodes::HdfsNameNodes(const std::string& nameNodes, unsigned port,
+                             const std::string& user):
+  spec(nameNodes), user(user), active(0), failing(false), recovering(false)
+{
+  pthread_mutex_init(&this->mtx_, 0);
+
+  std::stringstream nameNodeString(nameNodes);
+  std::string nameNode;
+
+  while (std::getline(nameNodeString, nameNode, ',')) {
+    HDFSUtil::trim(nameNode);
+    if (nameNode.empty())
+      continue;
+
+    Candidate candidate;
+    size_t colon = nameNode.find(':');
+
+    candidate.host    = nameNode.substr(0, colon);
+    candidate.port    = (colon == std::string::npos) ? port : (unsigned)atoi(nameNode.substr(colon + 1).c_str());
+    candidate.fs      = 0;
+    candidate.healthy = true;
+    candidate.latency = 0;
+
+    this->candidates.push_back(candidate);
+  }
+
+  Log(Logger::Lvl1, hdfslogmask, hdfslogname, "tracking " << this->candidates.size() << " namenodes: " << nameNodes);
+}
+
+
+
+void HdfsNameNodes::getActive(std::string& host, unsigned& port) throw ()
+{
+  HdfsLock l(&this->mtx_);
+  host = this->candidates[this->active].host;
+  port = this->candidates[this->active].port;
+}
+
+
+
+void HdfsNameNodes::reportFailure(const std::string& host, unsigned port) throw ()
+{
+  {
+    HdfsLock l(&this->mtx_);
+
+    Candidate& current = this->candidates[this->active];
+    if (current.host != host || current.port != port)
+      return; // Someone else already failed over
+
+    current.healthy = false;
+    // A failure of the replacement is part of the same failover
+    if (!this->failing && !this->recovering)
+      gettimeofday(&this->failingSince, NULL);
+    this->failing = true;
+
+    // Try the next candidate without waiting for the probes
+    if (!this->select())
+      this->failOver((this->active + 1) % this->candidates.size());
+  }
+
+  HdfsConnectionPool::instance()->flush(this->spec);
+}
+
+
+
+void HdfsNameNodes::reportSuccess(const std::string& host, unsigned port) throw ()
+{
+  HdfsLock l(&this->mtx_);
+
+  Candidate& current = this->candidates[this->active];
+  if (this->recovering && current.host == host && current.port == port)
+    this->recovered();
+}
+
+
+
+void HdfsNameNodes::probe(Candidate& candidate) throw ()
+{
+  struct timeval start;
+  gettimeofday(&start, NULL);
+
+  if (!candidate.fs)
+    candidate.fs = hdfsConnectAsUserNewInstance(candidate.host.c_str(), candidate.port, this->user.c_str());
+
+  // A standby namenode refuses the read operations
+  hdfsFileInfo* hInfo = candidate.fs ? hdfsGetPathInfo(candidate.fs, "/") : 0;
+
+  double latency = HDFSUtil::elapsed(start);
+
+  if (hInfo) {
+    hdfsFreeFileInfo(hInfo, 1);
+  }
+  else if (candidate.fs) {
+    hdfsDisconnect(candidate.fs);
+    candidate.fs = 0;
+  }
+
+  HdfsLock l(&this->mtx_);
+  candidate.healthy = (hInfo != 0);
+  candidate.latency = latency;
+
+  if (hInfo && this->recovering && &candidate == &this->candidates[this->active])
+    this->recovered();
+}
+
+
+
+bool HdfsNameNodes::select(void) throw ()
+{
+  size_t best = this->candidates.size();
+
+  for (size_t i = 0; i < this->candidates.size(); ++i) {
+    if (this->candidates[i].healthy &&
+        (best == this->candidates.size() || this->candidates[i].latency < this->candidates[best].latency))
+      best = i;
+  }
+
+  Candidate& current = this->candidates[this->active];
+
+  if (best == this->candidates.size()) {
+    if (!current.healthy && !this->failing) {
+      if (!this->recovering)
+        gettimeofday(&this->failingSince, NULL);
+      this->failing = true;
+      Err(hdfslogname, "no healthy namenode in " << this->spec);
+    }
+    return false;
+  }
+
+  // Stick to a healthy active namenode unless another one is much faster
+  if (best == this->active ||
+      (current.healthy && this->candidates[best].latency * 2 >= current.latency))
+    return false;
+
+  this->failOver(best);
+  return true;
+}
+
+
+
+void HdfsNameNodes::failOver(size_t to) throw ()
+{
+  Candidate& from = this->candidates[this->active];
+
+  if (this->failing) {
+    Log(Logger::Lvl1, hdfslogmask, hdfslogname, "failing over from " << from.host << ":" << from.port
+        << " to " << this->candidates[to].host << ":" << this->candidates[to].port
+        << ", " << HDFSUtil::elapsed(this->failingSince) << " ms after the first failure");
+    this->recovering = true;
+  }
+  else {
+    Log(Logger::Lvl1, hdfslogmask, hdfslogname, "switching from " << from.host << ":" << from.port
+        << " (" << from.latency << " ms) to " << this->candidates[to].host << ":" << this->candidates[to].port
+        << " (" << this->candidates[to].latency << " ms)");
+  }
+
+  this->active  = to;
+  this->failing = false;
+}
+
+
+
+void HdfsNameNodes::recovered(void) throw ()
+{
+  Candidate& current = this->candidates[this->active];
+
+  Log(Logger::Lvl1, hdfslogmask, hdfslogname, "failover to " << current.host << ":" << current.port
+      << " completed in " << HDFSUtil::elapsed(this->failingSince) << " ms");
+
+  this->recovering = false;
+}
+
+
+
+void* HdfsNameNodes::run(void* arg)
+{
+  HdfsNameNodes* selector = static_cast<HdfsNameNodes*>(arg);
+
+  while (true) {
+    // The candidates vector is never resized, so the references stay valid
+    for (size_t i = 0; i < selector->candidates.size(); ++i)
+      selector->probe(selector->candidates[i]);
+
+    bool changed;
+    {
+      HdfsLock l(&selector->mtx_);
+      changed = selector->select();
+    }
+
+    // Idle connections still point to the previous namenode
+    if (changed)
+      HdfsConnectionPool::instance()->flush(selector->spec);
+
+    sleep(probeInterval);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsNameNodes.h
+/// @brief   selection of the active namenode of a HA cluster.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSNAMENODES_H
+#define HDFSNAMENODES_H
+
+#include <hdfs.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dmlite {
+
+/// Tracks the active namenode of a list configured as "nn1[:port],nn2[:port]".
+/// A background thread probes every candidate, and new connections are
+/// routed to the fastest healthy one. A connection failure on the active
+/// namenode fails over to the next candidate straight away; the failover is
+/// complete once an RPC succeeds on the new active namenode.
+class HdfsNameNodes {
+public:
+	/// Returns the selector for the given list, creating it (and its probe
+	/// thread) the first time. Returns 0 if the list has a single namenode.
+	static HdfsNameNodes* get(const std::string& nameNodes, unsigned port,
+			const std::string& user) throw ();
+
+	static void setProbeInterval(unsigned seconds) throw ();
+
+	void getActive(std::string& host, unsigned& port) throw ();
+	void reportFailure(const std::string& host, unsigned port) throw ();
+	/// An RPC succeeded on the given namenode
+	void reportSuccess(const std::string& host, unsigned port) throw ();
+
+private:
+	HdfsNameNodes(const std::string& nameNodes, unsigned port, const std::string& user);
+
+	struct Candidate {
+		std::string host;
+		unsigned    port;
+		hdfsFS      fs;      // used only by the probe thread
+		bool        healthy;
+		double      latency; // ms, of the last probe
+	};
+
+	/// Issues a probe RPC, without holding mtx_
+	void probe(Candidate& candidate) throw ();
+	/// Picks the fastest healthy candidate. Called with mtx_ held, returns true if the active one changed
+	bool select(void) throw ();
+	/// Switches to a new active candidate. Called with mtx_ held
+	void failOver(size_t to) throw ();
+	/// First successful RPC on the active candidate after a failover. Called with mtx_ held
+	void recovered(void) throw ();
+
+	static void* run(void* arg);
+
+	std::string spec;
+	std::string user;
+
+	pthread_mutex_t mtx_;
+	std::vector<Candidate> candidates;
+	size_t active;
+
+	bool           failing;      // the active namenode is failing, no replacement yet
+	bool           recovering;   // failed over, no successful RPC on the new one yet
+	struct timeval failingSince; // first failure of the failover in progress
+
+	static unsigned probeInterval;
+};
+
+};
+
+#endif // HDFSNAMENODES_H
@@ -42,7 +42,9 @@ HdfsPoolDriver::HdfsPoolDriver(const std::string& passwd,
 
 HdfsPoolDriver::~HdfsPoolDriver()
 {
-  // Nothing
+  std::map<std::string, PoolHandler*>::iterator i;
+  for (i = this->handlers.begin(); i != this->handlers.end(); ++i)
+    delete i->second;
 }
 
 
@@ -93,14 +95,32 @@ PoolHandler* HdfsPoolDriver::createPoolHandler(const std::string& poolName) thro
                       "Wrong mode '%s' configured in the database for the hdfs pool %s",
                       meta.getString("mode").c_str(), poolName.c_str());
   
-  hdfsFS fs = hdfsConnectAsUserNewInstance(host.c_str(),
-                                port,
-                                uname.c_str());
-  if (fs == 0)
-    throw DmException(DMLITE_SYSERR(errno),
-                      "Could not create a HdfsPoolDriver: cannot connect to Hdfs");
-    
-  return new HdfsPoolHandler(this, host, poolName, fs, this->stack, mode,replication);
+  return new HdfsPoolHandler(this, host, port, uname, poolName, this->stack, mode,replication);
+}
+
+
+
+PoolHandler* HdfsPoolDriver::getPoolHandler(const std::string& poolName) throw (DmException)
+{
+  std::map<std::string, PoolHandler*>::iterator i = this->handlers.find(poolName);
+  if (i != this->handlers.end())
+    return i->second;
+
+  PoolHandler* handler = this->createPoolHandler(poolName);
+  this->handlers[poolName] = handler;
+  return handler;
+}
+
+
+
+void HdfsPoolDriver::dropPoolHandler(const std::string& poolName) throw ()
+{
+  std::map<std::string, PoolHandler*>::iterator i = this->handlers.find(poolName);
+  if (i != this->handlers.end()) {
+    Log(Logger::Lvl4,hdfslogmask,hdfslogname," dropping cached handler for pool " << poolName);
+    delete i->second;
+    this->handlers.erase(i);
+  }
 }
 
 
@@ -121,26 +141,27 @@ void HdfsPoolDriver::justCreated(const Pool& pool) throw (DmException)
 
 void HdfsPoolDriver::update(const Pool& pool) throw (DmException)
 {
-  // Nothing
+  this->dropPoolHandler(pool.name);
 }
 
 
 
 void HdfsPoolDriver::toBeDeleted(const Pool& pool) throw (DmException)
 {
-  // Nothing
+  this->dropPoolHandler(pool.name);
 }
 
 
 
 HdfsPoolHandler::HdfsPoolHandler(HdfsPoolDriver* driver,
                                      const std::string& nameNode,
+                                     unsigned port,
+                                     const std::string& uname,
                                      const std::string& poolName,
-                                     hdfsFS fs,
                                      StackInstance* si,
                                      char mode,
 				     unsigned replication):
-  driver(driver), nameNode(nameNode), fs(fs), poolName(poolName), stack(si),
+  driver(driver), nameNode(nameNode), port(port), uname(uname), poolName(poolName), stack(si),
   mode(mode), replication(replication)
 {
 //nothing to do 
@@ -150,7 +171,7 @@ HdfsPoolHandler::HdfsPoolHandler(HdfsPoolDriver* driver,
 
 HdfsPoolHandler::~HdfsPoolHandler()
 {
-  hdfsDisconnect(this->fs);
+  // Nothing
 }
 
 
@@ -171,11 +192,14 @@ std::string HdfsPoolHandler::getPoolName(void) throw (DmException)
 
 uint64_t HdfsPoolHandler::getTotalSpace(void) throw (DmException)
 {
-  tOffset total = hdfsGetCapacity(this->fs);
-  if (total < 0)
+  HdfsConnection conn(this->nameNode, this->port, this->uname);
+
+  tOffset total = hdfsGetCapacity(conn.get());
+  if (!conn.check(total >= 0)) {
     throw DmException(DMLITE_SYSERR(errno),
                       "Could not get the total capacity of %s",
                       this->poolName.c_str());
+  }
   //replication factor
   total = total/ this->replication;
   return total;
@@ -185,11 +209,14 @@ uint64_t HdfsPoolHandler::getTotalSpace(void) throw (DmException)
 
 uint64_t HdfsPoolHandler::getUsedSpace(void) throw (DmException)
 {
-  tOffset used = hdfsGetUsed(this->fs);
-  if (used < 0)
+  HdfsConnection conn(this->nameNode, this->port, this->uname);
+
+  tOffset used = hdfsGetUsed(conn.get());
+  if (!conn.check(used >= 0)) {
     throw DmException(DMLITE_SYSERR(errno),
                       "Could not get the free space of %s",
                       this->poolName.c_str());
+  }
   used = used/ this->replication;
   return used;
 }
@@ -224,11 +251,13 @@ bool HdfsPoolHandler::replicaIsAvailable(const Replica& replica) throw (DmExcept
 	  _rfn = _rfn.substr(index+1, _rfn.size());
   }
 
+  HdfsConnection conn(this->nameNode, this->port, this->uname);
+
   switch (replica.status) {
 	
     // Need to check if finished, and set the file size in that case
     case Replica::kBeingPopulated:
-      if (hdfsExists(this->fs, _rfn.c_str()) != 0) {
+      if (!conn.check(hdfsExists(conn.get(), _rfn.c_str()) == 0)) {
         return false;
       }
       // It does exist, so update status and size
@@ -238,8 +267,8 @@ bool HdfsPoolHandler::replicaIsAvailable(const Replica& replica) throw (DmExcept
 	
 	//moving to Catalog interface
 	this->stack->getCatalog()->updateReplica(copy);
-        hdfsFileInfo* hInfo = hdfsGetPathInfo(this->fs, _rfn.c_str());
-        if (!hInfo)
+        hdfsFileInfo* hInfo = hdfsGetPathInfo(conn.get(), _rfn.c_str());
+        if (!conn.check(hInfo != 0))
           throw DmException(DMLITE_SYSERR(errno), "Could not stat %s",
                             _rfn.c_str());
 
@@ -252,7 +281,7 @@ bool HdfsPoolHandler::replicaIsAvailable(const Replica& replica) throw (DmExcept
       return true;
     // If marked as available, if it actually exists
     case Replica::kAvailable:
-      return (hdfsExists(this->fs, _rfn.c_str()) == 0);
+      return conn.check(hdfsExists(conn.get(), _rfn.c_str()) == 0);
     // Being deleted, so no
     default:
       return false;
@@ -278,10 +307,14 @@ Location HdfsPoolHandler::whereToRead(const Replica& replica) throw (DmException
          _rfn = _rfn.substr(index+1, _rfn.size());
   }
     
-  chunk.url.domain = HDFSUtil::getRandomGateway(this->driver->gateways).c_str();
   chunk.url.path = _rfn;
   chunk.offset = 0;
   chunk.size   = this->stack->getCatalog()->extendedStat(_rfn,true).stat.st_size;
+  // Prefer a gateway which is also a datanode of the file blocks
+  {
+    HdfsConnection conn(this->nameNode, this->port, this->uname);
+    chunk.url.domain = HdfsLocality::getGateway(conn.get(), _rfn, chunk.size, this->driver->gateways);
+  }
 
   chunk.url.query["token"] = generateToken(this->driver->userId,
                                chunk.url.path,
@@ -298,11 +331,15 @@ Location HdfsPoolHandler::whereToRead(const Replica& replica) throw (DmException
 
 void HdfsPoolHandler::removeReplica(const Replica& replica) throw (DmException)
 {
-  switch (replica.status) {
-    case Replica::kBeingPopulated:
-      hdfsDelete(this->fs, (replica.rfn + ".upload").c_str(),0);
-    default:
-      hdfsDelete(this->fs, replica.rfn.c_str(),0);
+  {
+    HdfsConnection conn(this->nameNode, this->port, this->uname);
+
+    switch (replica.status) {
+      case Replica::kBeingPopulated:
+        hdfsDelete(conn.get(), (replica.rfn + ".upload").c_str(),0);
+      default:
+        hdfsDelete(conn.get(), replica.rfn.c_str(),0);
+    }
   }
   this->stack->getCatalog()->deleteReplica(replica);
 }
@@ -315,7 +352,10 @@ Location HdfsPoolHandler::whereToWrite(const std::string& fn) throw (DmException
   path = fn.substr(0, fn.find_last_of('/'));
 
   // Create the path
-  hdfsCreateDirectory(this->fs, path.c_str());
+  {
+    HdfsConnection conn(this->nameNode, this->port, this->uname);
+    hdfsCreateDirectory(conn.get(), path.c_str());
+  }
   
   // Uri returned_uri;
   Chunk single;
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsReadAhead.cpp
+/// @brief   prefetch of the sequential reads.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace dmlite;
+
+unsigned HdfsReadAhead::nBlocks   = 0;
+unsigned HdfsReadAhead::blockSize = 4 * 1024 * 1024;
+unsigned HdfsReadAhead::nThreads  = 4;
+
+
+
+void HdfsReadAhead::setBlocks(unsigned nBlocks) throw ()
+{
+  HdfsReadAhead::nBlocks = nBlocks;
+}
+
+
+
+void HdfsReadAhead::setBlockSize(unsigned size) throw ()
+{
+  HdfsReadAhead::blockSize = size > 0 ? size : BUFF_SIZE;
+}
+
+
+
+void HdfsReadAhead::setThreads(unsigned nThreads) throw ()
+{
+  HdfsReadAhead::nThreads = nThreads;
+  pool()->setThreads(nThreads);
+}
+
+
+
+bool HdfsReadAhead::enabled(void) throw ()
+{
+  return nBlocks > 0;
+}
+
+
+
+HdfsWorkerPool* HdfsReadAhead::pool(void)
+{
+  // Never freed, the workers run until the process exits
+  static HdfsWorkerPool* readers = new HdfsWorkerPool("read-ahead", nThreads, 0);
+  return readers;
+}
+
+
+
+tSize HdfsReadAhead::preadFully(hdfsFS fs, hdfsFile file, off_t offset,
+                                char* buffer, size_t count) throw ()
+{
+  size_t done = 0;
+
+  // hdfsPread stops at the block boundaries
+  while (done < count) {
+    tSize n = hdfsPread(fs, file, offset + done, buffer + done, count - done);
+    if (n < 0)
+      return done ? (tSize)done : -1;
+    if (n == 0)
+      break;
+    done += n;
+  }
+
+  return (tSize)done;
+}
+
+
+
+HdfsReadAhead::Block::Block(hdfsFS fs, hdfsFile file, off_t offset, size_t size):
+  fs(fs), file(file), offset(offset), size(size), data(size), nRead(0), consumed(0)
+{
+}
+
+
+
+void HdfsReadAhead::Block::run(void)
+{
+  this->nRead = HdfsReadAhead::preadFully(this->fs, this->file, this->offset, &this->data[0], this->size);
+  if (this->nRead > 0)
+    HdfsIOStats::readAheadFetched.add(this->nRead);
+}
+
+
+
+HdfsReadAhead::HdfsReadAhead(hdfsFS fs, hdfsFile file, off_t size):
+  fs(fs), file(file), mode(HdfsAccessPattern::kUnknown), end(size)
+{
+  pthread_mutex_init(&this->mtx_, 0);
+}
+
+
+
+HdfsReadAhead::~HdfsReadAhead()
+{
+  std::vector<Block*> dropped;
+  this->discard(dropped);
+  release(dropped);
+  pthread_mutex_destroy(&this->mtx_);
+}
+
+
+
+void HdfsReadAhead::drop(std::vector<Block*>& dropped) throw ()
+{
+  dropped.push_back(this->blocks.front());
+  this->blocks.pop_front();
+}
+
+
+
+void HdfsReadAhead::discard(std::vector<Block*>& dropped) throw ()
+{
+  while (!this->blocks.empty())
+    this->drop(dropped);
+}
+
+
+
+void HdfsReadAhead::release(std::vector<Block*>& dropped) throw ()
+{
+  for (std::vector<Block*>::iterator i = dropped.begin(); i != dropped.end(); ++i) {
+    Block* block = *i;
+    // The hdfs file must not be used after the handler is gone
+    block->wait();
+    if (block->nRead > 0 && (size_t)block->nRead > block->consumed)
+      HdfsIOStats::readAheadWasted.add(block->nRead - block->consumed);
+    block->unref();
+  }
+  dropped.clear();
+}
+
+
+
+bool HdfsReadAhead::submit(off_t offset, size_t size) throw ()
+{
+  Block* block = new Block(this->fs, this->file, offset, size);
+  if (!pool()->submit(block)) {
+    block->unref();
+    return false;
+  }
+  this->blocks.push_back(block);
+  return true;
+}
+
+
+
+void HdfsReadAhead::fill(off_t offset) throw ()
+{
+  off_t from = this->blocks.empty() ? offset
+                                    : this->blocks.back()->offset + (off_t)this->blocks.back()->size;
+
+  while (this->blocks.size() < nBlocks && from < this->end && this->submit(from, blockSize))
+    from += blockSize;
+}
+
+
+
+void HdfsReadAhead::fillStrided(off_t offset, size_t size, off_t stride) throw ()
+{
+  off_t from   = (this->blocks.empty() ? offset : this->blocks.back()->offset) + stride;
+
+  while (this->blocks.size() < nBlocks && from < this->end && this->submit(from, size))
+    from += stride;
+}
+
+
+
+void HdfsReadAhead::seek(off_t offset) throw ()
+{
+  std::vector<Block*> dropped;
+
+  {
+    HdfsLock l(&this->mtx_);
+
+    if (!this->blocks.empty() &&
+        (offset < this->blocks.front()->offset ||
+         offset >= this->blocks.back()->offset + (off_t)this->blocks.back()->size))
+      this->discard(dropped);
+  }
+
+  release(dropped);
+}
+
+
+
+tSize HdfsReadAhead::read(char* buffer, size_t count, off_t offset, bool positional) throw ()
+{
+  size_t done = 0;
+  bool   eof  = false;
+  std::vector<Block*> dropped;
+
+  {
+    HdfsLock l(&this->mtx_);
+
+    HdfsAccessPattern& classifier = positional ? this->preadPattern : this->pattern;
+    HdfsAccessPattern::Pattern pattern = classifier.record(offset, count);
+    if (pattern != this->mode) {
+      Log(Logger::Lvl4, hdfslogmask, hdfslogname, "access pattern: " << HdfsAccessPattern::name(pattern));
+      this->discard(dropped);
+      this->mode = pattern;
+    }
+
+    // Blocks behind the cursor will not be served anymore
+    while (!this->blocks.empty() &&
+           this->blocks.front()->offset + (off_t)this->blocks.front()->size <= offset)
+      this->drop(dropped);
+
+    if (pattern == HdfsAccessPattern::kSequential)
+      this->fill(offset);
+    else if (pattern == HdfsAccessPattern::kStrided)
+      this->fillStrided(offset, count, classifier.getStride());
+
+    while (done < count && !this->blocks.empty()) {
+      Block* block  = this->blocks.front();
+      off_t  cursor = offset + done;
+
+      if (cursor < block->offset)
+        break;
+
+      // The other readers go on meanwhile, the block may be dropped by one of them
+      block->ref();
+      pthread_mutex_unlock(&this->mtx_);
+      block->wait();
+      pthread_mutex_lock(&this->mtx_);
+      bool kept = (!this->blocks.empty() && this->blocks.front() == block);
+      block->unref();
+      if (!kept)
+        continue;
+
+      if (block->nRead < 0) {
+        // Let the direct read report the error
+        this->discard(dropped);
+        break;
+      }
+
+      off_t blockEnd = block->offset + block->nRead;
+      if ((size_t)block->nRead < block->size)
+        this->end = std::min(this->end, blockEnd);
+
+      if (cursor >= blockEnd) {
+        eof = (blockEnd >= this->end);
+        break;
+      }
+
+      size_t n = std::min((size_t)(blockEnd - cursor), count - done);
+      memcpy(buffer + done, &block->data[cursor - block->offset], n);
+      block->consumed += n;
+      done            += n;
+
+      if (offset + (off_t)done >= block->offset + (off_t)block->size)
+        this->drop(dropped);
+    }
+  }
+
+  release(dropped);
+  HdfsIOStats::readAheadHits.add(done);
+
+  // Outside of the lock, the random reads run concurrently
+  if (done < count && !eof) {
+    tSize n = preadFully(this->fs, this->file, offset + done, buffer + done, count - done);
+    if (n < 0) {
+      if (!done)
+        return -1;
+    }
+    else {
+      HdfsIOStats::readAheadMisses.add(n);
+      done += n;
+    }
+  }
+
+  return (tSize)done;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsReadAhead.h
+/// @brief   prefetch of the sequential reads.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSREADAHEAD_H
+#define HDFSREADAHEAD_H
+
+#include <hdfs.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <deque>
+#include <vector>
+#include "HdfsAccessPattern.h"
+#include "HdfsWorkerPool.h"
+
+namespace dmlite {
+
+/// Serves the reads of one hdfs file, prefetching on the read-ahead threads
+/// according to the access pattern: the blocks after the cursor for the
+/// sequential reads, the next records for the strided ones, nothing for the
+/// random ones. read() and pread() are classified apart, as the preads of
+/// parallel streams interleave. Thread safe, neither the random reads nor
+/// the waits for the prefetched blocks hold the lock.
+class HdfsReadAhead {
+public:
+	HdfsReadAhead(hdfsFS fs, hdfsFile file, off_t size);
+	/// Waits for the prefetches in flight
+	~HdfsReadAhead();
+
+	/// Number of blocks kept ahead of the cursor, 0 disables the read-ahead
+	static void setBlocks(unsigned nBlocks) throw ();
+	static void setBlockSize(unsigned size) throw ();
+	static void setThreads(unsigned nThreads) throw ();
+
+	static bool enabled(void) throw ();
+
+	/// Reads count bytes at offset, from the prefetched blocks when possible.
+	/// positional is set for the preads, which do not move the cursor.
+	/// Returns less than count only at the end of the file, -1 on error.
+	tSize read(char* buffer, size_t count, off_t offset, bool positional = false) throw ();
+
+	/// Drops the prefetched blocks if the cursor moves away from them
+	void seek(off_t offset) throw ();
+
+	/// hdfsPread until count bytes are read or the end of the file is reached
+	static tSize preadFully(hdfsFS fs, hdfsFile file, off_t offset,
+			char* buffer, size_t count) throw ();
+
+private:
+	HdfsReadAhead(const HdfsReadAhead&);
+	HdfsReadAhead& operator = (const HdfsReadAhead&);
+
+	class Block: public HdfsTask {
+	public:
+		Block(hdfsFS fs, hdfsFile file, off_t offset, size_t size);
+		void run(void);
+
+		hdfsFS   fs;
+		hdfsFile file;
+		off_t    offset;
+		size_t   size;
+		std::vector<char> data;
+		tSize    nRead;    // set by run()
+		size_t   consumed; // bytes served from the block
+	};
+
+	/// Submits blocks until nBlocks are ahead of offset
+	void fill(off_t offset) throw ();
+	/// Submits the next nBlocks records of size bytes, one stride apart
+	void fillStrided(off_t offset, size_t size, off_t stride) throw ();
+	/// Submits a block, returns false if the pool is full
+	bool submit(off_t offset, size_t size) throw ();
+	/// Moves the front block, or all of them, to the dropped list. Called with mtx_ held
+	void drop(std::vector<Block*>& dropped) throw ();
+	void discard(std::vector<Block*>& dropped) throw ();
+	/// Waits for the dropped blocks, counting what was never served. Called without mtx_
+	static void release(std::vector<Block*>& dropped) throw ();
+
+	static HdfsWorkerPool* pool(void);
+
+	hdfsFS   fs;
+	hdfsFile file;
+
+	pthread_mutex_t mtx_;
+	std::deque<Block*> blocks; // ordered by offset
+	HdfsAccessPattern pattern;      // of read()
+	HdfsAccessPattern preadPattern; // of the preads
+	HdfsAccessPattern::Pattern mode; // what the blocks were prefetched for
+	off_t    end;    // end of the file, nothing is prefetched past it
+
+	static unsigned nBlocks;
+	static unsigned blockSize;
+	static unsigned nThreads;
+};
+
+};
+
+#endif // HDFSREADAHEAD_H
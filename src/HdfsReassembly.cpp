@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsReassembly.cpp
+/// @brief   reordering of the writes of a streamed upload.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace dmlite;
+
+uint64_t HdfsReassembly::maxMemory = 64 * 1024 * 1024;
+uint64_t HdfsReassembly::budget    = 1024 * 1024 * 1024;
+
+
+
+static void pwriteFully(int fd, const char* buffer, size_t count, off_t offset) throw (DmException)
+{
+  size_t done = 0;
+  while (done < count) {
+    ssize_t n = ::pwrite(fd, buffer + done, count - done, offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throw DmException(errno, "Could not write the gap file");
+    done += n;
+  }
+}
+
+
+
+static void preadFully(int fd, char* buffer, size_t count, off_t offset) throw (DmException)
+{
+  size_t done = 0;
+  while (done < count) {
+    ssize_t n = ::pread(fd, buffer + done, count - done, offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw DmException(n < 0 ? errno : EIO, "Could not read the gap file");
+    done += n;
+  }
+}
+
+
+
+void HdfsReassembly::setMaxMemory(uint64_t bytes) throw ()
+{
+  maxMemory = bytes;
+}
+
+
+
+void HdfsReassembly::setBudget(uint64_t bytes) throw ()
+{
+  budget = bytes;
+}
+
+
+
+HdfsReassembly::HdfsReassembly(hdfsFS fs, hdfsFile file, const std::string& gapPath,
+                               HdfsChecksum* checksum):
+  fs(fs), file(file), checksum(checksum), flushedPos(0), length(0), memory(0), gapPath(gapPath), gapFd(-1)
+{
+}
+
+
+
+HdfsReassembly::~HdfsReassembly()
+{
+  std::map<off_t, Interval>::iterator i;
+  for (i = this->pending.begin(); i != this->pending.end(); ++i)
+    delete [] i->second.data;
+  HdfsIOStats::reassemblyMemory.sub(this->memory);
+
+  if (this->gapFd != -1) {
+    ::close(this->gapFd);
+    ::remove(this->gapPath.c_str());
+  }
+}
+
+
+
+void HdfsReassembly::openGapFile(void) throw (DmException)
+{
+  if (this->gapFd != -1)
+    return;
+
+  std::string folder = this->gapPath.substr(0, this->gapPath.find_last_of('/'));
+  struct stat st;
+  if (stat(folder.c_str(), &st) == -1 && HDFSUtil::mkdirs(folder.c_str()) == -1)
+    throw DmException(errno, "Could not create the temp folder for writing %s", folder.c_str());
+
+  this->gapFd = ::open(this->gapPath.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0700);
+  if (this->gapFd == -1)
+    throw DmException(errno, "Could not create the gap file %s", this->gapPath.c_str());
+  Log(Logger::Lvl4, hdfslogmask, hdfslogname, "opened gap file: " << this->gapPath);
+}
+
+
+
+void HdfsReassembly::writeFully(const char* buffer, size_t count) throw (DmException)
+{
+  // Only what hdfs took is checksummed and counted as flushed
+  size_t done = 0;
+  while (done < count) {
+    tSize n = hdfsWrite(this->fs, this->file, buffer + done, count - done);
+    if (n < 0)
+      throw DmException(EIO, "Could not write to the Hdfs file at offset %ld",
+                        (long)this->flushedPos);
+    if (this->checksum)
+      this->checksum->update(buffer + done, n);
+    this->flushedPos += n;
+    done += n;
+  }
+}
+
+
+
+bool HdfsReassembly::write(const char* buffer, size_t count, off_t offset) throw (DmException)
+{
+  if (offset < this->flushedPos)
+    return false;
+  if (count == 0)
+    return true;
+
+  off_t end = offset + count;
+  this->length = std::max(this->length, end);
+
+  // In order, straight to hdfs
+  if (offset == this->flushedPos && (this->pending.empty() || this->pending.begin()->first >= end)) {
+    this->writeFully(buffer, count);
+    this->flush();
+    return true;
+  }
+
+  HdfsIOStats::writesReordered.add();
+
+  // The pending data overlapped is replaced, the gaps between it are added
+  std::vector<Range> gaps;
+  off_t cursor = offset;
+
+  std::map<off_t, Interval>::iterator i = this->pending.upper_bound(offset);
+  if (i != this->pending.begin()) {
+    --i;
+    if (i->second.end <= offset)
+      ++i;
+  }
+
+  for (; i != this->pending.end() && i->first < end; ++i) {
+    if (cursor < i->first) {
+      Range gap = {cursor, (size_t)(i->first - cursor)};
+      gaps.push_back(gap);
+    }
+
+    off_t from = std::max(cursor, i->first);
+    off_t to   = std::min(end, i->second.end);
+    if (i->second.data)
+      memcpy(i->second.data + (from - i->first), buffer + (from - offset), to - from);
+    else
+      pwriteFully(this->gapFd, buffer + (from - offset), to - from, from);
+    cursor = to;
+  }
+
+  if (cursor < end) {
+    Range gap = {cursor, (size_t)(end - cursor)};
+    gaps.push_back(gap);
+  }
+
+  for (size_t g = 0; g < gaps.size(); ++g)
+    this->add(buffer + (gaps[g].offset - offset), gaps[g].size, gaps[g].offset);
+
+  // It may have filled the first gap
+  this->flush();
+  return true;
+}
+
+
+
+void HdfsReassembly::add(const char* buffer, size_t count, off_t offset) throw (DmException)
+{
+  Interval interval;
+  interval.end = offset + count;
+
+  // Reserved against the budget of the process too
+  bool inMemory = false;
+  if (this->memory + count <= maxMemory) {
+    HdfsIOStats::reassemblyMemory.add(count);
+    inMemory = (HdfsIOStats::reassemblyMemory.get() <= budget);
+    if (!inMemory)
+      HdfsIOStats::reassemblyMemory.sub(count);
+  }
+
+  if (inMemory) {
+    interval.data = new char[count];
+    memcpy(interval.data, buffer, count);
+    this->memory += count;
+  }
+  else {
+    this->openGapFile();
+    pwriteFully(this->gapFd, buffer, count, offset);
+    interval.data = 0;
+    HdfsIOStats::reassemblySpilled.add(count);
+  }
+
+  this->pending[offset] = interval;
+}
+
+
+
+void HdfsReassembly::flush(void) throw (DmException)
+{
+  while (!this->pending.empty() && this->pending.begin()->first == this->flushedPos) {
+    std::map<off_t, Interval>::iterator i = this->pending.begin();
+    size_t size = i->second.end - i->first;
+
+    if (i->second.data) {
+      this->writeFully(i->second.data, size);
+      delete [] i->second.data;
+      this->memory -= size;
+      HdfsIOStats::reassemblyMemory.sub(size);
+    }
+    else {
+      char buffer[BUFF_SIZE];
+      for (size_t done = 0; done < size; ) {
+        size_t n = std::min(size - done, sizeof(buffer));
+        preadFully(this->gapFd, buffer, n, i->first + done);
+        this->writeFully(buffer, n);
+        done += n;
+      }
+    }
+
+    this->pending.erase(i);
+  }
+}
+
+
+
+void HdfsReassembly::finish(void) throw (DmException)
+{
+  static const char zeros[BUFF_SIZE] = {0};
+
+  while (!this->pending.empty()) {
+    off_t next = this->pending.begin()->first;
+    while (this->flushedPos < next) {
+      size_t n = std::min((off_t)sizeof(zeros), next - this->flushedPos);
+      this->writeFully(zeros, n);
+    }
+    this->flush();
+  }
+}
+
+
+
+void HdfsReassembly::getPending(std::vector<Range>& ranges) const throw ()
+{
+  std::map<off_t, Interval>::const_iterator i;
+  for (i = this->pending.begin(); i != this->pending.end(); ++i) {
+    Range range = {i->first, (size_t)(i->second.end - i->first)};
+    ranges.push_back(range);
+  }
+}
+
+
+
+void HdfsReassembly::readPending(char* buffer, size_t count, off_t offset) throw (DmException)
+{
+  std::map<off_t, Interval>::iterator i = this->pending.upper_bound(offset);
+  if (i == this->pending.begin())
+    throw DmException(EINVAL, "No pending data at offset %ld", (long)offset);
+  --i;
+  if (offset + (off_t)count > i->second.end)
+    throw DmException(EINVAL, "No pending data at offset %ld", (long)offset);
+
+  if (i->second.data)
+    memcpy(buffer, i->second.data + (offset - i->first), count);
+  else
+    preadFully(this->gapFd, buffer, count, offset);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsReassembly.h
+/// @brief   reordering of the writes of a streamed upload.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSREASSEMBLY_H
+#define HDFSREASSEMBLY_H
+
+#include <dmlite/cpp/exceptions.h>
+#include <hdfs.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "HdfsChecksum.h"
+
+namespace dmlite {
+
+/// Puts back in order the writes of an upload sent over parallel streams.
+/// The data following what is in hdfs already is written as soon as it
+/// arrives, the writes after a gap wait for it: in memory up to the limits
+/// of the upload and of the process, in a sparse gap file at their own
+/// offsets beyond them.
+class HdfsReassembly {
+public:
+	/// Memory held by the pending writes of an upload
+	static void setMaxMemory(uint64_t bytes) throw ();
+	/// Memory held by the pending writes of all the uploads
+	static void setBudget(uint64_t bytes) throw ();
+
+	/// The gap file is created at gapPath the first time the memory is full.
+	/// checksum, if not 0, is updated with the data in order
+	HdfsReassembly(hdfsFS fs, hdfsFile file, const std::string& gapPath,
+			HdfsChecksum* checksum = 0);
+	~HdfsReassembly();
+
+	/// Returns false, writing nothing, for a write before flushed(),
+	/// which is in hdfs already
+	bool write(const char* buffer, size_t count, off_t offset) throw (DmException);
+	/// Writes the pending data, the gaps left are zeroed
+	void finish(void) throw (DmException);
+
+	/// Bytes written to hdfs
+	off_t flushed(void) const { return flushedPos; }
+	/// End of the furthest write
+	off_t size(void) const { return length; }
+
+	/// Pending data, for the uploads which can not be streamed anymore
+	struct Range {
+		off_t  offset;
+		size_t size;
+	};
+	void getPending(std::vector<Range>& ranges) const throw ();
+	/// Reads within one of the pending ranges
+	void readPending(char* buffer, size_t count, off_t offset) throw (DmException);
+
+private:
+	struct Interval {
+		off_t end;
+		char* data; // 0 if in the gap file
+	};
+
+	/// Keeps a write not overlapping the pending ones
+	void add(const char* buffer, size_t count, off_t offset) throw (DmException);
+	/// Writes the pending intervals starting at flushedPos
+	void flush(void) throw (DmException);
+	/// Advances flushedPos by the bytes written, also if it throws
+	void writeFully(const char* buffer, size_t count) throw (DmException);
+	void openGapFile(void) throw (DmException);
+
+	hdfsFS   fs;
+	hdfsFile file;
+	HdfsChecksum* checksum;
+	std::map<off_t, Interval> pending; // by offset, not overlapping
+	off_t    flushedPos;
+	off_t    length;
+	uint64_t memory;
+
+	std::string gapPath;
+	int         gapFd;
+
+	static uint64_t maxMemory;
+	static uint64_t budget;
+};
+
+};
+
+#endif // HDFSREASSEMBLY_H
@@ -121,3 +121,37 @@ std::string HDFSUtil::trim(std::string& str) throw ()
 }
 
 
+
+double HDFSUtil::elapsed(const struct timeval& start) throw ()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_usec - start.tv_usec) / 1000.0;
+}
+
+
+
+// libhdfs maps the exceptions it does not know, the IPC ones among them, to EINTERNAL
+#ifndef EINTERNAL
+#define EINTERNAL 255
+#endif
+
+bool HDFSUtil::isConnectionError(int err) throw ()
+{
+    switch (err) {
+      case EIO:
+      case EINTERNAL:
+      case ETIMEDOUT:
+      case ECONNREFUSED:
+      case ECONNRESET:
+      case ECONNABORTED:
+      case EHOSTUNREACH:
+      case ENETUNREACH:
+      case ENETDOWN:
+      case ENOTCONN:
+      case EPIPE:
+        return true;
+      default:
+        return false;
+    }
+}
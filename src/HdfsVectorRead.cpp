@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsVectorRead.cpp
+/// @brief   vectored reads of an hdfs file.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+using namespace dmlite;
+
+unsigned HdfsVectorRead::maxGap   = 64 * 1024;
+unsigned HdfsVectorRead::maxSize  = 4 * 1024 * 1024;
+unsigned HdfsVectorRead::nThreads = 8;
+
+
+
+void HdfsVectorRead::setMaxGap(unsigned maxGap) throw ()
+{
+  HdfsVectorRead::maxGap = maxGap;
+}
+
+
+
+void HdfsVectorRead::setMaxSize(unsigned maxSize) throw ()
+{
+  HdfsVectorRead::maxSize = maxSize;
+}
+
+
+
+void HdfsVectorRead::setThreads(unsigned nThreads) throw ()
+{
+  HdfsVectorRead::nThreads = nThreads;
+  pool()->setThreads(nThreads);
+}
+
+
+
+HdfsWorkerPool* HdfsVectorRead::pool(void)
+{
+  // Never freed, the workers run until the process exits
+  static HdfsWorkerPool* readers = new HdfsWorkerPool("readv", nThreads, 0);
+  return readers;
+}
+
+
+
+HdfsVectorRead::Read::Read(hdfsFS fs, hdfsFile file, off_t offset, size_t size):
+  fs(fs), file(file), offset(offset), size(size), nRead(0)
+{
+}
+
+
+
+void HdfsVectorRead::Read::run(void)
+{
+  // A lone range is read in place
+  if (this->chunks.size() == 1) {
+    HdfsReadChunk* chunk = this->chunks[0];
+    this->nRead  = HdfsReadAhead::preadFully(this->fs, this->file, this->offset, chunk->buffer, this->size);
+    chunk->nRead = this->nRead > 0 ? this->nRead : 0;
+    return;
+  }
+
+  this->data.resize(this->size);
+  this->nRead = HdfsReadAhead::preadFully(this->fs, this->file, this->offset, &this->data[0], this->size);
+  if (this->nRead < 0)
+    return;
+
+  // Scatter back, the ranges may overlap
+  off_t end = this->offset + this->nRead;
+  for (size_t i = 0; i < this->chunks.size(); ++i) {
+    HdfsReadChunk* chunk = this->chunks[i];
+    if (chunk->offset >= end)
+      continue;
+    chunk->nRead = std::min(chunk->size, (size_t)(end - chunk->offset));
+    memcpy(chunk->buffer, &this->data[chunk->offset - this->offset], chunk->nRead);
+  }
+}
+
+
+
+static bool byOffset(const HdfsReadChunk* a, const HdfsReadChunk* b)
+{
+  return a->offset < b->offset;
+}
+
+
+
+size_t HdfsVectorRead::read(hdfsFS fs, hdfsFile file,
+                            std::vector<HdfsReadChunk>& chunks) throw (DmException)
+{
+  std::vector<HdfsReadChunk*> sorted;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    chunks[i].nRead = 0;
+    if (chunks[i].size > 0)
+      sorted.push_back(&chunks[i]);
+  }
+  std::sort(sorted.begin(), sorted.end(), byOffset);
+
+  // Merge the ranges separated by less than maxGap bytes
+  std::vector<Read*> reads;
+  Read* current = 0;
+
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    HdfsReadChunk* chunk    = sorted[i];
+    off_t          chunkEnd = chunk->offset + chunk->size;
+
+    if (current) {
+      off_t end = current->offset + current->size;
+      if (chunk->offset <= end + (off_t)maxGap &&
+          std::max(end, chunkEnd) - current->offset <= (off_t)maxSize) {
+        current->size = std::max(end, chunkEnd) - current->offset;
+        current->chunks.push_back(chunk);
+        continue;
+      }
+    }
+
+    current = new Read(fs, file, chunk->offset, chunk->size);
+    current->chunks.push_back(chunk);
+    reads.push_back(current);
+  }
+
+  Log(Logger::Lvl4, hdfslogmask, hdfslogname, "readv of " << sorted.size() << " ranges in " << reads.size() << " reads");
+
+  // Fan out, keeping the first read (and the ones the pool refuses) for this thread
+  std::vector<bool> queued(reads.size(), false);
+  for (size_t i = 1; i < reads.size(); ++i)
+    queued[i] = pool()->submit(reads[i]);
+
+  for (size_t i = 0; i < reads.size(); ++i) {
+    if (!queued[i])
+      reads[i]->run();
+  }
+
+  bool   failed = false;
+  size_t total  = 0;
+
+  for (size_t i = 0; i < reads.size(); ++i) {
+    if (queued[i])
+      reads[i]->wait();
+    if (reads[i]->nRead < 0)
+      failed = true;
+    reads[i]->unref();
+  }
+
+  if (failed)
+    throw DmException(EIO, "Could not read %u ranges", (unsigned)sorted.size());
+
+  for (size_t i = 0; i < sorted.size(); ++i)
+    total += sorted[i]->nRead;
+  return total;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsVectorRead.h
+/// @brief   vectored reads of an hdfs file.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSVECTORREAD_H
+#define HDFSVECTORREAD_H
+
+#include <dmlite/cpp/exceptions.h>
+#include <hdfs.h>
+#include <sys/types.h>
+#include <vector>
+#include "HdfsWorkerPool.h"
+
+namespace dmlite {
+
+/// One range of a vectored read
+struct HdfsReadChunk {
+	off_t   offset;
+	size_t  size;
+	char*   buffer;
+	size_t  nRead; // set by the read, less than size only at the end of the file
+};
+
+/// Reads a list of ranges with as few hdfsPread calls as possible: the
+/// ranges are sorted, the close ones are merged, and the merged reads run
+/// in parallel on the vectored read threads.
+class HdfsVectorRead {
+public:
+	/// Ranges closer than maxGap bytes are read at once, up to maxSize bytes
+	static void setMaxGap(unsigned maxGap) throw ();
+	static void setMaxSize(unsigned maxSize) throw ();
+	static void setThreads(unsigned nThreads) throw ();
+
+	/// Returns the total number of bytes read
+	static size_t read(hdfsFS fs, hdfsFile file,
+			std::vector<HdfsReadChunk>& chunks) throw (DmException);
+
+private:
+	/// Merged ranges, read into the chunk buffer directly when alone
+	class Read: public HdfsTask {
+	public:
+		Read(hdfsFS fs, hdfsFile file, off_t offset, size_t size);
+		void run(void);
+
+		hdfsFS   fs;
+		hdfsFile file;
+		off_t    offset;
+		size_t   size;
+		std::vector<HdfsReadChunk*> chunks;
+		std::vector<char> data;
+		tSize    nRead;
+	};
+
+	static HdfsWorkerPool* pool(void);
+
+	static unsigned maxGap;
+	static unsigned maxSize;
+	static unsigned nThreads;
+};
+
+};
+
+#endif // HDFSVECTORREAD_H
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsWorkerPool.cpp
+/// @brief   small fixed size thread pools for background hdfs calls.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#include "Hdfs.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+using namespace dmlite;
+
+
+
+HdfsTask::HdfsTask(): refs(1), done(false), abandoned(false)
+{
+  pthread_mutex_init(&this->mtx_, 0);
+  pthread_cond_init(&this->cond_, 0);
+}
+
+
+
+HdfsTask::~HdfsTask()
+{
+  pthread_cond_destroy(&this->cond_);
+  pthread_mutex_destroy(&this->mtx_);
+}
+
+
+
+bool HdfsTask::wait(unsigned timeout)
+{
+  HdfsLock l(&this->mtx_);
+
+  if (timeout == 0) {
+    while (!this->done)
+      pthread_cond_wait(&this->cond_, &this->mtx_);
+    return true;
+  }
+
+  struct timeval  now;
+  struct timespec deadline;
+  gettimeofday(&now, NULL);
+  deadline.tv_sec  = now.tv_sec + timeout / 1000;
+  deadline.tv_nsec = now.tv_usec * 1000 + (timeout % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  while (!this->done) {
+    if (pthread_cond_timedwait(&this->cond_, &this->mtx_, &deadline) == ETIMEDOUT && !this->done) {
+      this->abandoned = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+
+
+void HdfsTask::finish(void)
+{
+  bool abandoned;
+  {
+    HdfsLock l(&this->mtx_);
+    this->done = true;
+    abandoned  = this->abandoned;
+    pthread_cond_broadcast(&this->cond_);
+  }
+
+  if (abandoned)
+    this->onAbandoned();
+}
+
+
+
+void HdfsTask::ref(void)
+{
+  HdfsLock l(&this->mtx_);
+  this->refs++;
+}
+
+
+
+void HdfsTask::unref(void)
+{
+  bool last;
+  {
+    HdfsLock l(&this->mtx_);
+    last = (--this->refs == 0);
+  }
+  if (last)
+    delete this;
+}
+
+
+
+HdfsWorkerPool::HdfsWorkerPool(const std::string& name, unsigned nThreads, unsigned maxQueue):
+  name(name), nThreads(nThreads), maxQueue(maxQueue)
+{
+  pthread_mutex_init(&this->mtx_, 0);
+  pthread_cond_init(&this->cond_, 0);
+}
+
+
+
+HdfsWorkerPool::~HdfsWorkerPool()
+{
+  // The pools are process-wide and never destroyed while the threads run
+  pthread_cond_destroy(&this->cond_);
+  pthread_mutex_destroy(&this->mtx_);
+}
+
+
+
+void HdfsWorkerPool::setThreads(unsigned nThreads)
+{
+  HdfsLock l(&this->mtx_);
+  this->nThreads = nThreads > 0 ? nThreads : 1;
+}
+
+
+
+void HdfsWorkerPool::setMaxQueue(unsigned maxQueue)
+{
+  HdfsLock l(&this->mtx_);
+  this->maxQueue = maxQueue;
+}
+
+
+
+unsigned HdfsWorkerPool::queued(void)
+{
+  HdfsLock l(&this->mtx_);
+  return this->queue.size();
+}
+
+
+
+bool HdfsWorkerPool::submit(HdfsTask* task)
+{
+  HdfsLock l(&this->mtx_);
+
+  if (this->maxQueue && this->queue.size() >= this->maxQueue)
+    return false;
+
+  while (this->threads.size() < this->nThreads) {
+    pthread_t      thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, work, this);
+    pthread_attr_destroy(&attr);
+
+    if (err) {
+      Err(hdfslogname, "could not start a " << this->name << " thread: " << strerror(err));
+      if (this->threads.empty())
+        return false;
+      break;
+    }
+    this->threads.push_back(thread);
+  }
+
+  {
+    HdfsLock t(&task->mtx_);
+    task->refs++;
+  }
+
+  this->queue.push_back(task);
+  pthread_cond_signal(&this->cond_);
+  return true;
+}
+
+
+
+void* HdfsWorkerPool::work(void* arg)
+{
+  HdfsWorkerPool* pool = static_cast<HdfsWorkerPool*>(arg);
+
+  while (true) {
+    HdfsTask* task;
+    {
+      HdfsLock l(&pool->mtx_);
+      while (pool->queue.empty())
+        pthread_cond_wait(&pool->cond_, &pool->mtx_);
+      task = pool->queue.front();
+      pool->queue.pop_front();
+    }
+
+    try {
+      task->run();
+    }
+    catch (...) {
+      Err(hdfslogname, "unexpected exception in a " << pool->name << " task");
+    }
+
+    task->finish();
+    task->unref();
+  }
+
+  return NULL;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) CERN 2013
+ *
+ * Copyright (c) Members of the EMI Collaboration. 2010-2013
+ * See  http://www.eu-emi.eu/partners for details on the copyright
+ * holders.
+ *
+ * Licensed under Apache License Version 2.0
+ *
+*/
+/// @file    plugins/hadoop/HdfsWorkerPool.h
+/// @brief   small fixed size thread pools for background hdfs calls.
+/// @author  Andrea Manzi <andrea.manzi@cern.ch>
+#ifndef HDFSWORKERPOOL_H
+#define HDFSWORKERPOOL_H
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace dmlite {
+
+/// Unit of work run by a HdfsWorkerPool.
+/// Tasks are reference counted: the submitter and the worker hold one
+/// reference each, and the last one to call unref() deletes the task.
+/// A submitter which stops waiting abandons the task: onAbandoned() is then
+/// called by the worker once run() is over, to dispose of the result.
+class HdfsTask {
+public:
+	HdfsTask();
+	virtual ~HdfsTask();
+
+	virtual void run(void) = 0;
+	virtual void onAbandoned(void) {}
+
+	/// Waits for the task to be over, at most timeout ms if not 0.
+	/// Returns false (and abandons the task) on timeout.
+	bool wait(unsigned timeout = 0);
+
+	/// Takes one more reference, given back with unref()
+	void ref(void);
+	void unref(void);
+
+private:
+	friend class HdfsWorkerPool;
+
+	/// Called by the worker when run() is over
+	void finish(void);
+
+	pthread_mutex_t mtx_;
+	pthread_cond_t  cond_;
+	int  refs;
+	bool done;
+	bool abandoned;
+};
+
+/// Fixed number of threads running queued tasks, started on the first submit
+class HdfsWorkerPool {
+public:
+	HdfsWorkerPool(const std::string& name, unsigned nThreads, unsigned maxQueue);
+	~HdfsWorkerPool();
+
+	/// Queues the task, taking a reference on it.
+	/// Returns false if the queue is full.
+	bool submit(HdfsTask* task);
+
+	void setThreads(unsigned nThreads);
+	void setMaxQueue(unsigned maxQueue);
+
+	unsigned queued(void);
+
+private:
+	static void* work(void* arg);
+
+	std::string name;
+
+	pthread_mutex_t mtx_;
+	pthread_cond_t  cond_;
+	std::deque<HdfsTask*> queue;
+	std::vector<pthread_t> threads;
+
+	unsigned nThreads;
+	unsigned maxQueue;
+};
+
+};
+
+#endif // HDFSWORKERPOOL_H
@@ -0,0 +1,98 @@
+#include <dmlite/cpp/dmlite.h>
+#include "../src/Hdfs.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+// Sequential and random read throughput for hdfs buffer sizes from 4 KB to 16 MB
+
+static double since(const struct timeval& start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+
+ 	dmlite::PluginManager manager;
+
+  	if (argc < 3) {
+    		std::cout << "Usage: " << argv[0] << " <config> <pfn> [readSize] [randomReads]" << std::endl;
+    		return 1;
+  	}
+
+	size_t   readSize    = argc > 3 ? atoi(argv[3]) : 64 * 1024;
+	unsigned randomReads = argc > 4 ? atoi(argv[4]) : 1000;
+
+  	try {
+    		manager.loadConfiguration(argv[1]);
+  	}
+  	catch (dmlite::DmException& e) {
+    		std::cout << "Could not load the configuration file." << std::endl << "Reason: " << e.what() << std::endl;
+    		return 1;
+  	}
+	// Create StackInstance
+ 	dmlite::StackInstance stack(&manager);
+
+  	//Set security credentials
+  	dmlite::SecurityCredentials creds;
+  	creds.clientName = "/DC=ch/DC=cern/OU=Organic Units/OU=Users/CN=amanzi/CN=683749/CN=Andrea Manzi";
+
+  	creds.remoteAddress = "127.0.0.1";
+  	try {
+    		stack.setSecurityCredentials(creds);
+  	}
+  	catch (dmlite::DmException& e) {
+    	std::cout << "Could not set the credentials." << std::endl
+              << "Reason: " << e.what() << std::endl;
+    	return 4;
+  	}
+
+	dmlite::IODriver* iodriver = stack.getIODriver();
+	std::vector<char> buffer(readSize);
+
+	std::cout << "buffer size\tsequential MB/s\trandom reads/s" << std::endl;
+
+	for (unsigned bufferSize = 4096; bufferSize <= 16 * 1024 * 1024; bufferSize *= 4) {
+		dmlite::Extensible      extras;
+	        extras["token"] = dmlite::generateToken("127.0.0.1", argv[2], "kwpoMyvcusgdbyyws6gfcxhntkLoh8jilwivnivel", 1000, false);//change third parameter to your value of TokenPassword
+		extras["hdfsBufferSize"] = bufferSize;
+
+		try {
+			// Whole file, readSize bytes at a time
+			dmlite::IOHandler *handler = iodriver->createIOHandler(argv[2],0, extras,  O_RDONLY );
+			struct timeval start;
+			gettimeofday(&start, NULL);
+
+			size_t total = 0, n;
+			while ((n = handler->read(&buffer[0], readSize)) > 0)
+				total += n;
+			double sequential = since(start);
+			off_t size = handler->fstat().st_size;
+			delete(handler);
+
+			// readSize bytes at random offsets
+			handler = iodriver->createIOHandler(argv[2],0, extras,  O_RDONLY );
+			gettimeofday(&start, NULL);
+
+			unsigned seed = 1;
+			off_t range = size > (off_t)readSize ? size - readSize : 1;
+			for (unsigned i = 0; i < randomReads; ++i)
+				handler->pread(&buffer[0], readSize, rand_r(&seed) % range);
+			double random = since(start);
+			delete(handler);
+
+			std::cout << bufferSize << "\t\t" << total / sequential / (1024 * 1024)
+			          << "\t\t" << randomReads / random << std::endl;
+		}
+		catch (dmlite::DmException& e) {
+			std::cout << "Read failed with a buffer of " << bufferSize << " bytes: " << e.what() << std::endl;
+			return 5;
+		}
+	}
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+#include <dmlite/cpp/dmlite.h>
+#include "../src/Hdfs.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+// Latency of close() for uploads from 1 MB to maxSize, which copies the temp file to hdfs,
+// then of 1, 2, 4... up to maxCloses uploads of maxSize closed at the same time.
+// Files <pfn>.<size> and <pfn>.<n>.<i> are left in hdfs
+
+static double since(const struct timeval& start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+}
+
+struct Closer {
+	dmlite::IOHandler* handler;
+	double close;
+	bool   failed;
+};
+
+static void* closerThread(void* arg)
+{
+	Closer* closer = static_cast<Closer*>(arg);
+	struct timeval start;
+	gettimeofday(&start, NULL);
+
+	try {
+		closer->handler->close();
+	}
+	catch (dmlite::DmException& e) {
+		std::cout << "close failed: " << e.what() << std::endl;
+		closer->failed = true;
+	}
+	closer->close = since(start);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+
+ 	dmlite::PluginManager manager;
+
+  	if (argc < 3) {
+    		std::cout << "Usage: " << argv[0] << " <config> <pfn> [maxSize] [maxCloses]" << std::endl;
+    		return 1;
+  	}
+
+	off_t maxSize = argc > 3 ? strtoull(argv[3], NULL, 10) : 1024 * 1024 * 1024;
+	unsigned maxCloses = argc > 4 ? atoi(argv[4]) : 8;
+
+  	try {
+    		manager.loadConfiguration(argv[1]);
+  	}
+  	catch (dmlite::DmException& e) {
+    		std::cout << "Could not load the configuration file." << std::endl << "Reason: " << e.what() << std::endl;
+    		return 1;
+  	}
+	// Create StackInstance
+ 	dmlite::StackInstance stack(&manager);
+
+  	//Set security credentials
+  	dmlite::SecurityCredentials creds;
+  	creds.clientName = "/DC=ch/DC=cern/OU=Organic Units/OU=Users/CN=amanzi/CN=683749/CN=Andrea Manzi";
+
+  	creds.remoteAddress = "127.0.0.1";
+  	try {
+    		stack.setSecurityCredentials(creds);
+  	}
+  	catch (dmlite::DmException& e) {
+    	std::cout << "Could not set the credentials." << std::endl
+              << "Reason: " << e.what() << std::endl;
+    	return 4;
+  	}
+
+	dmlite::IODriver* iodriver = stack.getIODriver();
+	std::vector<char> buffer(1024 * 1024, 'x');
+
+	std::cout << "file size\twrite s\t\tclose s\t\tclose MB/s" << std::endl;
+
+	for (off_t size = 1024 * 1024; size <= maxSize; size *= 4) {
+		std::stringstream pfn;
+		pfn << argv[2] << "." << size;
+
+		dmlite::Extensible      extras;
+	        extras["token"] = dmlite::generateToken("127.0.0.1", pfn.str(), "kwpoMyvcusgdbyyws6gfcxhntkLoh8jilwivnivel", 1000, true);//change third parameter to your value of TokenPassword
+
+		try {
+			dmlite::IOHandler *handler = iodriver->createIOHandler(pfn.str(), O_WRONLY | O_CREAT, extras, 0644);
+			struct timeval start;
+			gettimeofday(&start, NULL);
+
+			for (off_t written = 0; written < size; written += buffer.size())
+				handler->write(&buffer[0], buffer.size());
+			double write = since(start);
+
+			gettimeofday(&start, NULL);
+			handler->close();
+			double close = since(start);
+			delete(handler);
+
+			std::cout << size << "\t" << write << "\t" << close
+			          << "\t" << size / close / (1024 * 1024) << std::endl;
+		}
+		catch (dmlite::DmException& e) {
+			std::cout << "Upload of " << size << " bytes failed: " << e.what() << std::endl;
+			return 5;
+		}
+	}
+
+	std::cout << std::endl << "closes	max close s	avg close s	total MB/s" << std::endl;
+
+	for (unsigned nCloses = 1; nCloses <= maxCloses; nCloses *= 2) {
+		std::vector<Closer>    closers(nCloses);
+		std::vector<pthread_t> threads(nCloses);
+
+		// Written one after the other, only the copies to hdfs overlap
+		for (unsigned i = 0; i < nCloses; ++i) {
+			std::stringstream pfn;
+			pfn << argv[2] << "." << nCloses << "." << i;
+
+			dmlite::Extensible      extras;
+		        extras["token"] = dmlite::generateToken("127.0.0.1", pfn.str(), "kwpoMyvcusgdbyyws6gfcxhntkLoh8jilwivnivel", 1000, true);//change third parameter to your value of TokenPassword
+
+			try {
+				closers[i].handler = iodriver->createIOHandler(pfn.str(), O_WRONLY | O_CREAT, extras, 0644);
+				for (off_t written = 0; written < maxSize; written += buffer.size())
+					closers[i].handler->write(&buffer[0], buffer.size());
+			}
+			catch (dmlite::DmException& e) {
+				std::cout << "Upload of " << pfn.str() << " failed: " << e.what() << std::endl;
+				return 5;
+			}
+			closers[i].close  = 0;
+			closers[i].failed = false;
+		}
+
+		struct timeval start;
+		gettimeofday(&start, NULL);
+
+		for (unsigned i = 0; i < nCloses; ++i)
+			pthread_create(&threads[i], NULL, closerThread, &closers[i]);
+
+		double maxClose = 0, totalClose = 0;
+		bool   failed = false;
+		for (unsigned i = 0; i < nCloses; ++i) {
+			pthread_join(threads[i], NULL);
+			maxClose    = std::max(maxClose, closers[i].close);
+			totalClose += closers[i].close;
+			failed     |= closers[i].failed;
+			delete closers[i].handler;
+		}
+		double elapsed = since(start);
+
+		if (failed)
+			return 5;
+
+		std::cout << nCloses << "\t" << maxClose << "\t" << totalClose / nCloses
+		          << "\t" << (double)maxSize * nCloses / elapsed / (1024 * 1024) << std::endl;
+	}
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <dmlite/cpp/dmlite.h>
+#include "../src/Hdfs.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+// Parallel preads on one handler, with 1, 2, 4... threads up to maxThreads
+
+struct Reader {
+	dmlite::IOHandler* handler;
+	off_t    size;
+	size_t   readSize;
+	unsigned nReads;
+	unsigned seed;
+	size_t   bytes;
+	bool     failed;
+};
+
+static void* readerThread(void* arg)
+{
+	Reader* reader = static_cast<Reader*>(arg);
+	std::vector<char> buffer(reader->readSize);
+
+	try {
+		for (unsigned i = 0; i < reader->nReads; ++i) {
+			off_t range  = reader->size > (off_t)reader->readSize ? reader->size - reader->readSize : 1;
+			off_t offset = (off_t)(rand_r(&reader->seed) % range);
+			reader->bytes += reader->handler->pread(&buffer[0], reader->readSize, offset);
+		}
+	}
+	catch (dmlite::DmException& e) {
+		std::cout << "pread failed: " << e.what() << std::endl;
+		reader->failed = true;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+
+ 	dmlite::PluginManager manager;
+
+  	if (argc < 3) {
+    		std::cout << "Usage: " << argv[0] << " <config> <pfn> [maxThreads] [readSize] [readsPerThread]" << std::endl;
+    		return 1;
+  	}
+
+	unsigned maxThreads = argc > 3 ? atoi(argv[3]) : 16;
+	size_t   readSize   = argc > 4 ? atoi(argv[4]) : 128 * 1024;
+	unsigned nReads     = argc > 5 ? atoi(argv[5]) : 100;
+
+  	try {
+    		manager.loadConfiguration(argv[1]);
+  	}
+  	catch (dmlite::DmException& e) {
+    		std::cout << "Could not load the configuration file." << std::endl << "Reason: " << e.what() << std::endl;
+    		return 1;
+  	}
+	// Create StackInstance
+ 	dmlite::StackInstance stack(&manager);
+
+  	//Set security credentials
+  	dmlite::SecurityCredentials creds;
+  	creds.clientName = "/DC=ch/DC=cern/OU=Organic Units/OU=Users/CN=amanzi/CN=683749/CN=Andrea Manzi";
+
+  	creds.remoteAddress = "127.0.0.1";
+  	try {
+    		stack.setSecurityCredentials(creds);
+  	}
+  	catch (dmlite::DmException& e) {
+    	std::cout << "Could not set the credentials." << std::endl
+              << "Reason: " << e.what() << std::endl;
+    	return 4;
+  	}
+
+	dmlite::Extensible      extras;
+        extras["token"] = dmlite::generateToken("127.0.0.1", argv[2], "kwpoMyvcusgdbyyws6gfcxhntkLoh8jilwivnivel", 1000, false);//change third parameter to your value of TokenPassword
+
+	dmlite::IODriver* iodriver = stack.getIODriver();
+	dmlite::IOHandler *handler = iodriver->createIOHandler(argv[2],0, extras,  O_RDONLY );
+
+	off_t size = handler->fstat().st_size;
+	std::cout << "file size " << size << ", " << readSize << " bytes per pread, "
+	          << nReads << " preads per thread" << std::endl;
+
+	for (unsigned nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+		std::vector<Reader>    readers(nThreads);
+		std::vector<pthread_t> threads(nThreads);
+
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		for (unsigned i = 0; i < nThreads; ++i) {
+			readers[i].handler  = handler;
+			readers[i].size     = size;
+			readers[i].readSize = readSize;
+			readers[i].nReads   = nReads;
+			readers[i].seed     = i + 1;
+			readers[i].bytes    = 0;
+			readers[i].failed   = false;
+			pthread_create(&threads[i], NULL, readerThread, &readers[i]);
+		}
+
+		size_t bytes = 0;
+		for (unsigned i = 0; i < nThreads; ++i) {
+			pthread_join(threads[i], NULL);
+			bytes += readers[i].bytes;
+			if (readers[i].failed)
+				return 5;
+		}
+
+		gettimeofday(&end, NULL);
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+		std::cout << nThreads << " threads: " << bytes / seconds / (1024 * 1024) << " MB/s, "
+		          << nThreads * nReads / seconds << " preads/s" << std::endl;
+	}
+
+	delete(handler);
+
+  return 0;
+}